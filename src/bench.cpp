@@ -19,8 +19,13 @@
 #include "bench.h"
 
 #include <string>
+#include <cstring> // std::memset
+#include <vector>
+#include <chrono>
+#include <iomanip>
 
 #include "time.h"
+#include "transposition.h"
 
 // From Berserk
 static std::string positions[] = {
@@ -76,34 +81,306 @@ static std::string positions[] = {
     "r1bq2k1/p4r1p/1pp2pp1/3p4/1P1B3Q/P2B1N2/2P3PP/4R1K1 b - - 2 19"
 };
 
-void bench(std::thread& search_thread, board_t *board, searchinfo_t *info) {
+namespace {
+
+// Number of bench positions
+constexpr int positions_no = sizeof(positions) / sizeof(positions[0]);
+
+/**
+ @brief Searches all bench positions to the given depth
+ @param depth depth to search the positions to
+ @param total_time stores the total time taken (in ms)
+ @param verbose whether to print the nodes & time for each position
+ @param hit_rate if set, stores the share of TT probes finding their position
+ @returns the total number of nodes searched
+ */
+uint64_t run_bench(board_t *board, searchinfo_t *info, int depth,
+                   uint64_t &total_time, bool verbose, double *hit_rate = nullptr) {
 
     // Bench parameters
     info->clear();
-    info->depth = 13;
+    info->depth = depth;
     info->time_set = false;
 
-    uint64_t times[50] = {};
-    uint64_t nodes[50] = {};
+    // Every run starts with clean histories, so that runs are comparable
+    run_on_threads([](thread_t *thread) {
+        std::memset(thread->history_h, 0, sizeof(thread->history_h));
+    });
+
+    uint64_t times[positions_no] = {};
+    uint64_t nodes[positions_no] = {};
     uint64_t total_nodes = 0ULL;
-    uint64_t start = 0ULL, total_time = 1ULL; // handle div-by-zero
-    for (int i = 0; i < 50; ++i) {
+    uint64_t start = 0ULL;
+    uint64_t probes = 0ULL, found = 0ULL;
+    total_time = 1ULL; // handle div-by-zero
+    for (int i = 0; i < positions_no; ++i) {
         setup(board, positions[i]);
         info->start = start = now();
-        search_start(search_thread, board, info);
-        if (search_thread.joinable()) {
-            search_thread.join();
-        }
+        search_start(board, info);
+        search_wait();
         times[i] = now() - start;
-        nodes[i] = info->nodes;
+        nodes[i] = nodes_searched();
         total_time  += times[i];
         total_nodes += nodes[i];
-        std::cout << positions[i] << " " \
-                  << nodes[i]     << " " \
-                  << times[i]     << std::endl;
+        // (the TT statistics are reset by every search)
+        const tt_stats_t stats = tt_stats_searched();
+        probes += stats.probes_no();
+        found  += stats.found_no();
+        if (verbose) {
+            std::cout << positions[i] << " " \
+                      << nodes[i]     << " " \
+                      << times[i]     << std::endl;
+        }
     }
+    if (hit_rate) {
+        *hit_rate = probes ? static_cast<double>(found) / probes : 0.0;
+    }
+    return total_nodes;
+}
+
+/**
+ @brief Measures the average latency of a transposition table probe (in ns)
+ as seen by the threads of the pool. Every probed key depends on the result
+ of the previous probe, hence the memory accesses can't overlap
+ */
+double probe_latency() {
+    constexpr int probes_no = 1 << 20;
+    std::vector<double> latency(threads.size());
+
+    run_on_threads([&latency](thread_t *thread) {
+        board_t *board = thread->board;
+        tt_entry entry[1];
+        move_t move;
+        int score;
+        uint64_t key = thread->id + 1;
+        board->ply = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < probes_no; ++i) {
+            // LCG step, mixed with the previously probed entry
+            key = key * 6364136223846793005ULL + 1442695040888963407ULL + entry->key;
+            board->key = key;
+            tt.probe(board, entry, move, score, -oo, +oo, 0);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        latency[thread->id] =
+            std::chrono::duration<double, std::nano>(elapsed).count() / probes_no;
+    });
+
+    double total = 0.0;
+    for (double l : latency) {
+        total += l;
+    }
+    return total / latency.size();
+}
+
+} // namespace
+
+void bench(board_t *board, searchinfo_t *info) {
+    uint64_t total_time;
+    uint64_t total_nodes = run_bench(board, info, 13, total_time, true);
+
     std::cout << std::endl;
     std::cout << total_nodes << " nodes " \
         << int(1000.0 * total_nodes / total_time) << " nps " \
         << total_time << " ms " << std::endl;
 }
+
+void bench_numa(board_t *board, searchinfo_t *info) {
+    // The threads are pinned during both runs, only the placement
+    // of the transposition table differs
+    bool was_pinned = set_numa_pinning(true);
+    const int size_MB = tt.size_MB();
+
+    for (bool spread : {false, true}) {
+        // Reallocate the table, so that the pages get placed anew
+        tt.resize(size_MB);
+        if (spread) {
+            clear_tt();
+        } else {
+            // The main thread first-touches the entire table
+            run_on_threads([](thread_t *thread) {
+                if (thread->id == 0) tt.clear();
+            });
+        }
+
+        double latency = probe_latency();
+        tt.clear();
+
+        uint64_t total_time;
+        uint64_t total_nodes = run_bench(board, info, 13, total_time, false);
+
+        std::cout << "TT placement: " << (spread ? "spread across nodes" : "single node") \
+            << std::endl \
+            << "  probe latency " << std::setprecision(4) << latency << " ns" \
+            << std::endl \
+            << "  " << total_nodes << " nodes " \
+            << int(1000.0 * total_nodes / total_time) << " nps " \
+            << total_time << " ms " << std::endl;
+    }
+
+    set_numa_pinning(was_pinned);
+    tt.resize(size_MB);
+    clear_tt();
+}
+
+void bench_huge_pages(board_t *board, searchinfo_t *info) {
+    const bool huge_pages = tt.set_huge_pages(false);
+    const int size_MB = tt.size_MB();
+
+    for (bool enabled : {false, true}) {
+        tt.set_huge_pages(enabled);
+        tt.resize(size_MB);
+        clear_tt();
+
+        double latency = probe_latency();
+        clear_tt();
+
+        uint64_t total_time;
+        uint64_t total_nodes = run_bench(board, info, 13, total_time, false);
+
+        std::cout << "TT backed by " << tt.pages_info() \
+            << std::endl \
+            << "  probe latency " << std::setprecision(4) << latency << " ns" \
+            << std::endl \
+            << "  " << total_nodes << " nodes " \
+            << int(1000.0 * total_nodes / total_time) << " nps " \
+            << total_time << " ms " << std::endl;
+    }
+
+    tt.set_huge_pages(huge_pages);
+    tt.resize(size_MB);
+    clear_tt();
+}
+
+void bench_eval_cache(board_t *board, searchinfo_t *info) {
+    for (bool enabled : {false, true}) {
+        run_on_threads([enabled](thread_t *thread) {
+            thread->eval.eval_cache = enabled ? &thread->eval_cache : nullptr;
+            thread->eval_cache.clear();
+            thread->eval.cache_probes = thread->eval.cache_hits = 0;
+        });
+        clear_tt();
+
+        uint64_t total_time;
+        uint64_t total_nodes = run_bench(board, info, 13, total_time, false);
+
+        uint64_t probes = 0ULL, hits = 0ULL;
+        for (const auto &thread : threads) {
+            probes += thread->eval.cache_probes;
+            hits   += thread->eval.cache_hits;
+        }
+        std::cout << "Evaluation cache: " << (enabled ? "enabled" : "disabled");
+        if (enabled) {
+            std::cout << " (" << probes << " probes, hit rate " << std::setprecision(4)
+                      << (probes ? 100.0 * hits / probes : 0.0) << "%)";
+        }
+        std::cout << std::endl \
+            << "  " << total_nodes << " nodes " \
+            << int(1000.0 * total_nodes / total_time) << " nps " \
+            << total_time << " ms " << std::endl;
+    }
+}
+
+void bench_lazy_eval(board_t *board, searchinfo_t *info) {
+    // (the default margin is benched if the lazy evaluation is disabled)
+    const int previous = lazy_margin();
+    const int margin = previous ? previous : LAZY_MARGIN;
+
+    for (int m : {0, margin}) {
+        set_lazy_margin(m);
+        run_on_threads([](thread_t *thread) {
+            thread->eval_cache.clear();
+            thread->eval.lazy_probes = thread->eval.lazy_exits = 0;
+        });
+        clear_tt();
+
+        uint64_t total_time;
+        uint64_t total_nodes = run_bench(board, info, 13, total_time, false);
+
+        uint64_t probes = 0ULL, exits = 0ULL;
+        for (const auto &thread : threads) {
+            probes += thread->eval.lazy_probes;
+            exits  += thread->eval.lazy_exits;
+        }
+        std::cout << "Lazy evaluation: ";
+        if (m) {
+            std::cout << "margin " << m << " (" << probes << " lazy evaluations, "
+                      << std::setprecision(4) << (probes ? 100.0 * exits / probes : 0.0)
+                      << "% exiting early)";
+        } else {
+            std::cout << "disabled";
+        }
+        std::cout << std::endl \
+            << "  " << total_nodes << " nodes " \
+            << int(1000.0 * total_nodes / total_time) << " nps " \
+            << total_time << " ms " << std::endl;
+    }
+
+    set_lazy_margin(previous);
+}
+
+void bench_nnue(board_t *board, searchinfo_t *info) {
+    const bool loaded = nnue_loaded();
+    if (!loaded) {
+        std::cout << "No network loaded, using a random one" << std::endl;
+        nnue_load_random(0x9e3779b97f4a7c15ULL);
+    }
+    const bool used = nnue_use(false);
+    const NNUE_KERNEL kernel = nnue_kernel();
+
+    for (NNUE_KERNEL k : {NNUE_KERNEL::NO, NNUE_KERNEL::SCALAR, NNUE_KERNEL::SSE, NNUE_KERNEL::AVX2}) {
+        if (k != NNUE_KERNEL::NO && !nnue_kernel_supported(k)) {
+            continue;
+        }
+        nnue_use(k != NNUE_KERNEL::NO);
+        nnue_set_kernel(nnue_kernel_name(k));
+        run_on_threads([](thread_t *thread) { thread->eval_cache.clear(); });
+        clear_tt();
+
+        // (at a lower depth, a random network makes for far larger trees)
+        uint64_t total_time;
+        uint64_t total_nodes = run_bench(board, info, 9, total_time, false);
+
+        std::cout << "Evaluation: " \
+            << (k == NNUE_KERNEL::NO ? "hand-crafted" : "NNUE " + std::string(nnue_kernel_name(k))) \
+            << std::endl \
+            << "  " << total_nodes << " nodes " \
+            << int(1000.0 * total_nodes / total_time) << " nps " \
+            << total_time << " ms " << std::endl;
+    }
+
+    nnue_set_kernel(nnue_kernel_name(kernel));
+    nnue_use(used);
+    if (!loaded) {
+        nnue_unload();
+    }
+    clear_tt();
+}
+
+void bench_compact(board_t *board, searchinfo_t *info) {
+    const bool compact = tt.set_compact(false);
+
+    for (bool enabled : {false, true}) {
+        // Same memory, (re)allocated with the given layout
+        tt.set_compact(enabled);
+        allocate_tt();
+
+        double hit_rate;
+        uint64_t total_time;
+        uint64_t total_nodes = run_bench(board, info, 13, total_time, false, &hit_rate);
+
+        std::cout << "TT layout: " << (enabled ? "compact" : "full") << " ("
+            << tt.bucket_size() << " entries per bucket)" \
+            << std::endl \
+            << "  hit rate " << std::setprecision(4) << 100.0 * hit_rate << "%" \
+            << std::endl \
+            << "  " << total_nodes << " nodes " \
+            << int(1000.0 * total_nodes / total_time) << " nps " \
+            << total_time << " ms " << std::endl;
+    }
+
+    tt.set_compact(compact);
+    allocate_tt();
+}
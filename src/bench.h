@@ -23,6 +23,31 @@
 #include "board.h"
 #include "threads.h"
 
-void bench(std::thread &search_thread, board_t *board, searchinfo_t *info);
+// Searches a fixed set of positions, reporting the nodes searched & nps
+void bench(board_t *board, searchinfo_t *info);
+
+// Compares the nps and the transposition table probe latency with the table
+// placed on a single NUMA node vs. spread across the nodes of the threads
+void bench_numa(board_t *board, searchinfo_t *info);
+
+// Compares the nps and the transposition table probe latency with the table
+// backed by regular pages vs. huge pages
+void bench_huge_pages(board_t *board, searchinfo_t *info);
+
+// Compares the nps without vs. with the per-thread evaluation cache, reporting
+// the cache's hit rate
+void bench_eval_cache(board_t *board, searchinfo_t *info);
+
+// Compares the nps of the hand-crafted evaluation vs. the network with each
+// of the supported kernels (with a random network, unless one is loaded)
+void bench_nnue(board_t *board, searchinfo_t *info);
+
+// Compares the nodes & nps with the full vs. the lazy evaluation, reporting
+// how often the lazy evaluation exits early
+void bench_lazy_eval(board_t *board, searchinfo_t *info);
+
+// Compares the TT hit rate and the time to depth with the full vs. compact
+// TT entry layout (at the same Hash size, set it low to fill the table)
+void bench_compact(board_t *board, searchinfo_t *info);
 
 #endif // BENCH_H_
@@ -36,10 +36,12 @@
 #include "rng.h"
 #include "threads.h"
 #include "see.h"
+#include "eval.h"
 
 #ifdef DEBUG
 size_t boards = 0;
-std::vector<board_t> ref_boards(64); // TODO: C-style array
+// (every search thread keeps its own reference boards)
+thread_local std::vector<board_t> ref_boards(64); // TODO: C-style array
 #endif
 
 /*******************/
@@ -52,7 +54,7 @@ uint64_t castle_keys[16] = {}; // == WK | WQ | BK | BQ + 1 = 0b1111 + 1
 uint64_t *ep_keys;
 
 void init_keys() {
-    seed_rng();
+    seed_rng(ZOBRIST_SEED);
     // For each piece type and square generate a random key
     for (piece_t p = NO_PIECE; p < PIECE_NO; ++p) {
         for (square_t sq = A1; sq <= H8; ++sq) {
@@ -111,8 +113,14 @@ void reset(board_t *board) {
     // Reset 50rule counter
     board->fifty_move = 0;
 
-    // Clear Zobrist board key
+    // Clear Zobrist board keys
     board->key = 0ULL;
+    board->pawn_key = 0ULL;
+    board->material_key = 0ULL;
+
+    // Clear the material + PSQT accumulators
+    board->psqt = 0;
+    board->phase = 0;
 }
 
 // TODO: Parsing current board position to a FEN string
@@ -204,6 +212,12 @@ void setup(board_t *board, const std::string& fen) {
 
     // Generate the starting position key for this FEN
     board->key = generate_pos_key(board);
+    board->pawn_key = generate_pawn_key(board);
+    board->material_key = generate_material_key(board);
+    generate_psqt(board, &board->psqt, &board->phase);
+    if (nnue_active()) {
+        nnue_refresh(board, &board->accumulator);
+    }
 }
 /**
  @brief Returns a FEN representation of the current board
@@ -417,6 +431,44 @@ void test(board_t *board) {
 }
 
 
+/* Generates the pawn key from scratch for the current position */
+uint64_t generate_pawn_key(const board_t *board) {
+    uint64_t key = 0ULL;
+    for (piece_t pce : {P, p}) {
+        bb_t b = board->bitboards[pce];
+        while (b) {
+            key ^= piece_keys[pce][POPLSB(b)];
+        }
+    }
+    return key;
+}
+
+/* Generates the material key from scratch for the current position
+ * (the i-th piece of a type is hashed in by the key of the type on square i) */
+uint64_t generate_material_key(const board_t *board) {
+    uint64_t key = 0ULL;
+    for (piece_t pce : pieces) {
+        for (int i = 0; i < CNT(board->bitboards[pce]); ++i) {
+            key ^= piece_keys[pce][i];
+        }
+    }
+    return key;
+}
+
+/* Sums the material + PSQT scores & the phase weights from scratch for the
+ * current position */
+void generate_psqt(const board_t *board, score_t *score, int *phase) {
+    *score = 0;
+    *phase = 0;
+    for (piece_t pce : pieces) {
+        bb_t b = board->bitboards[pce];
+        while (b) {
+            *score += psqt[pce][POPLSB(b)];
+            *phase += PHASE_WEIGHT[pce];
+        }
+    }
+}
+
 /* Helpers for manipulating pieces on the board */
 
 // Adds a piece pce to board on square sq
@@ -432,6 +484,18 @@ inline static void add_piece(board_t *board, piece_t pce, square_t sq) {
 
     // Hash the piece into the Zobrist key for the board
     board->key ^= piece_keys[pce][sq];
+    if (piece_type(pce) == PAWN) {
+        board->pawn_key ^= piece_keys[pce][sq];
+    }
+    board->material_key ^= piece_keys[pce][CNT(board->bitboards[pce]) - 1];
+
+    // Add the piece to the material + PSQT accumulators
+    board->psqt += psqt[pce][sq];
+    board->phase += PHASE_WEIGHT[pce];
+
+    if (nnue_active()) {
+        nnue_add(&board->accumulator, pce, sq);
+    }
 }
 
 // Removes a piece pce from board on square sq
@@ -449,6 +513,18 @@ inline static void rm_piece(board_t *board, square_t sq) {
 
     // Hash the piece out of the Zobrist key for the board
     board->key ^= piece_keys[pce][sq];
+    if (piece_type(pce) == PAWN) {
+        board->pawn_key ^= piece_keys[pce][sq];
+    }
+    board->material_key ^= piece_keys[pce][CNT(board->bitboards[pce])];
+
+    // Remove the piece from the material + PSQT accumulators
+    board->psqt -= psqt[pce][sq];
+    board->phase -= PHASE_WEIGHT[pce];
+
+    if (nnue_active()) {
+        nnue_remove(&board->accumulator, pce, sq);
+    }
 }
 
 // Moves a piece pce from 'from' to 'to'
@@ -470,6 +546,70 @@ inline static void mv_piece(board_t *board, square_t from, square_t to) {
     /* Hash the piece out of the old square and into the new */
     board->key ^= piece_keys[pce][from];
     board->key ^= piece_keys[pce][to];
+    if (piece_type(pce) == PAWN) {
+        board->pawn_key ^= piece_keys[pce][from] ^ piece_keys[pce][to];
+    }
+
+    // Only the PSQT scores change (the material & phase stay the same)
+    board->psqt += psqt[pce][to] - psqt[pce][from];
+
+    if (nnue_active()) {
+        nnue_move(&board->accumulator, pce, from, to);
+    }
+}
+
+// Returns the Zobrist key of the position after the move (without making it)
+uint64_t key_after(const board_t *board, move_t move) {
+    square_t from = get_from(move);
+    square_t to = get_to(move);
+    int flags = get_flags(move);
+    piece_t piece = board->pieces[from];
+    piece_t placed = piece;
+
+    int dir = board->turn == WHITE ? NORTH : SOUTH;
+
+    uint64_t key = board->key ^ turn_key;
+
+    if (flags == EPCAPTURE) {
+        key ^= piece_keys[board->pieces[to - dir]][to - dir];
+    }
+    else if (flags & CAPTURE) {
+        key ^= piece_keys[board->pieces[to]][to];
+    }
+
+    if (is_promotion(move)) {
+        switch (flags & ~CAPTURE) {
+            case KNIGHTPROMO: placed = set_colour(KNIGHT, board->turn); break;
+            case BISHOPPROMO: placed = set_colour(BISHOP, board->turn); break;
+            case ROOKPROMO:   placed = set_colour(ROOK,   board->turn); break;
+            case QUEENPROMO:  placed = set_colour(QUEEN,  board->turn); break;
+        }
+    }
+    key ^= piece_keys[piece][from] ^ piece_keys[placed][to];
+
+    if (board->ep_square != NO_SQ) {
+        key ^= ep_keys[board->ep_square];
+    }
+    if (flags == PAWNPUSH) {
+        key ^= ep_keys[to - dir];
+    }
+
+    if (flags == KINGCASTLE || flags == QUEENCASTLE) {
+        square_t rook_from = NO_SQ, rook_to = NO_SQ;
+        switch (to) {
+            case G1: rook_from = H1; rook_to = F1; break;
+            case C1: rook_from = A1; rook_to = D1; break;
+            case G8: rook_from = H8; rook_to = F8; break;
+            case C8: rook_from = A8; rook_to = D8; break;
+        }
+        piece_t rook = board->pieces[rook_from];
+        key ^= piece_keys[rook][rook_from] ^ piece_keys[rook][rook_to];
+    }
+
+    int castle_rights = board->castle_rights & castle_spoils[from] & castle_spoils[to];
+    key ^= castle_keys[board->castle_rights] ^ castle_keys[castle_rights];
+
+    return key;
 }
 
 /**
@@ -482,6 +622,7 @@ bool make_move(board_t *board, move_t move) {
 
     #ifdef DEBUG
     assert(check(board));
+    const uint64_t expected_key = key_after(board, move);
     // Store the board state (for debugging purposes)
     //ref_boards[boards++] = *board;
     ref_boards.push_back(*board);
@@ -576,6 +717,7 @@ bool make_move(board_t *board, move_t move) {
     board->key ^= turn_key;
 
     assert(check(board));
+    assert(board->key == expected_key);
 
     // Finally, undo the move if puts the player in check (pseudolegal move)
     //if (is_attacked(board, king_square(board, me), opp)) {
@@ -689,6 +831,7 @@ void make_null(board_t *board) {
     board->ep_square = NO_SQ;
 
     // Miscellaneous bookkeeping
+    // (the NNUE accumulators hold both perspectives, so they stay as they are)
     board->turn ^= 1;
     board->key ^= turn_key;
 
@@ -857,6 +1000,20 @@ bool check(const board_t *board) {
       print(board);
       return false;
     }
+    assert(board->pawn_key == generate_pawn_key(board));
+    assert(board->material_key == generate_material_key(board));
+    #ifdef DEBUG
+    score_t psqt_score;
+    int phase;
+    generate_psqt(board, &psqt_score, &phase);
+    assert(board->psqt == psqt_score);
+    assert(board->phase == phase);
+    if (nnue_active()) {
+        nnue_accumulator_t accumulator;
+        nnue_refresh(board, &accumulator);
+        assert(std::memcmp(&accumulator, &board->accumulator, sizeof(accumulator)) == 0);
+    }
+    #endif
 
     assert(board->ep_square == NO_SQ ||
            (SQUARE_RANK(board->ep_square) == RANK_3 && board->turn == BLACK) ||
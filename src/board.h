@@ -23,6 +23,7 @@
 
 #include "types.h"
 #include "bitboard.h"
+#include "nnue.h"
 
 
 /************************/
@@ -56,13 +57,23 @@ typedef struct board_t {
     square_t ep_square = NO_SQ;
     // Zobrist hash key for the current position
     uint64_t key = 0ULL;
+    // Zobrist hash key of the pawns only (for the pawn hash table)
+    uint64_t pawn_key = 0ULL;
+    // Zobrist hash key of the material, i.e. of the number of pieces of
+    // each type (for the material hash table)
+    uint64_t material_key = 0ULL;
+    // Material + PSQT score from White's POV and the phase weight of the
+    // material, updated incrementally (see eval.h)
+    score_t psqt = 0;
+    int phase = 0;
+    // Accumulators of the NNUE feature transformer (only kept up to date
+    // while the network is in use, see nnue.h)
+    nnue_accumulator_t accumulator;
     // History of previous positions
     undo_t history[MAX_MOVES];
     // Killer moves for move ordering (cause a beta cutoff but aren't captures)
     // move_t killer1[MAX_DEPTH] = {};
     // move_t killer2[MAX_DEPTH] = {};
-    // History heuristic, table indexed by [stm][piece][to square]
-    int32_t history_h[BOTH][PIECE_NO][SQUARE_NO] = {};
 } board_t;
 
 #ifdef DEBUG
@@ -73,6 +84,9 @@ extern void perft_test(board_t *board, const std::string& epd_filename);
 #endif // DEBUG
 
 
+// Seed of the PRNG generating the Zobrist keys (saved TTs depend on it)
+constexpr uint64_t ZOBRIST_SEED = 42069ULL;
+
 extern void init_keys();
 
 extern void reset(board_t *board);
@@ -85,10 +99,25 @@ extern void test(board_t *board);
 
 extern uint64_t generate_pos_key(const board_t *board);
 
+extern uint64_t generate_pawn_key(const board_t *board);
+
+extern uint64_t generate_material_key(const board_t *board);
+
+extern void generate_psqt(const board_t *board, score_t *score, int *phase);
+
 bool is_repetition(const board_t *board);
 
 bool make_move(board_t *board, move_t move);
 
+/**
+ @brief Computes the Zobrist key of the position after a move without making
+ it (e.g. to prefetch the transposition table before making the move)
+ @param board the position before the move
+ @param move a pseudo-legal move in the position
+ @returns the key the board will have once the move is made
+ */
+uint64_t key_after(const board_t *board, move_t move);
+
 void undo_move(board_t *board, move_t move);
 void undo_move(board_t *board); // Undo last move
 
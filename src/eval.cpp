@@ -19,268 +19,91 @@
 /* Evaluation */
 #include "eval.h"
 
-/* Piece values */
-
-/* PESTO's piece values */
-int value_mg[PIECE_NO] = {0, 82, 337, 365, 477, 1025, 50000,
-                              0, 0, 82, 337, 365, 477, 1025, 50000};
-int value_eg[PIECE_NO] = {0, 94, 281, 297, 512, 936, 50000,
-                              0, 0, 94, 281, 297, 512, 936, 50000};
-
-// REVIEW: 4th PMO Tuning iteration parameters
-// Tempo score (a small bonus for the side to move)
-int tempo_bonus_mg = 6;
-int tempo_bonus_eg = 0;
-// Pass and isolated pawn
-int isolated_pawn = -8;
-//// Doubled pawn penalty
-int doubled_pawn = -12;
-// REVIEW: Bonus for supported pawns
-int pawn_supported = 3;
-// Bonus for pieces supported by pawns
-int pawn_protected_bonus = 2;
-// Indexed by rank, i.e. the closer to promoting, the higher the bonus
-int passed_pawn[RANK_NO] = {0, 5, 10, 20, 35, 60, 100, 200};
-// REVIEW: Indexed by rank, bonus for good pawn structure
-int pawn_bonuses[RANK_NO] = { 0, 0, 0, 5, 22, 42, 50, 65 };
-// Bonus for having two bishops on board
-int bishop_pair_mg = 3;
-int bishop_pair_eg = 53;
-// Bonuses for rooks/queens on open/semi-open files
-int rook_open_file = 11;
-int rook_semiopen_file = 5;
-int queen_open_file = 8;
-int queen_semiopen_file = 2;
-// Mobility weights depending on the piece type
-int mobility_weights[PIECE_NO] = {0, 0, 2, 2, 1, 1, 0, 0, 0, 0, 2, 2, 1, 1, 0};
-
-/* King safety parameters */
-int PAWN_SHIELD1_BONUS = 5;
-int PAWN_SHIELD2_BONUS = 4;
-int PAWN_STORM_PENALTY = 6;
-
-// Stronger pieces have a larger weight when attacking the enemy king
-int KING_ATTACK_WEIGHT[PIECE_NO] = {0, 0, 1, 1, 2, 4, 0, 0, 0, 0, 1, 1, 2, 4, 0};
-
-// 49 is the max size of the king zone (refer to get_king_zone())
-// We use the weighted number of attackers onto the king zone
-// as an index into this array as a predictor
-// of how dangerous the opponent's attack is
-int KING_SAFETY_TABLE[50] = {
-    0,   1,   2,   3,   5,   7,   9,   12,  15,  18,
-    22,  26,  30,  35,  40,  45,  51,  57,  63,  70,
-    77,  84,  92,  100, 108, 117, 126, 135, 145, 155,
-    165, 176, 187, 198, 210, 222, 234, 247, 260, 273,
-    287, 301, 315, 330, 345, 360, 376, 392, 408, 425
-};
-
-// REVIEW: These need to be tuned
-int KING_PAWN_DIST_BONUS = 9;
-int SAFE_PAWN_ATTACK = 18;
-// Knight outpost bonuses
-int KNIGHT_OUTPOST_MG = 5;
-int KNIGHT_OUTPOST_EG = 2;
-
-/* Piece-square tables */
-
-/* Flipped PESTO's PSQTs
- * see: https://www.chessprogramming.org/PeSTO%27s_Evaluation_Function
- * */
-
-int pawn_table_mg[SQUARE_NO] = {
-     0,   0,   0,   0,   0,   0,   0,   0,
-   -35,  -1, -20, -23, -15,  24,  38, -22,
-   -26,  -4,  -4, -10,   3,   3,  33, -12,
-   -27,  -2,  -5,  12,  17,   6,  10, -25,
-   -14,  13,   6,  21,  23,  12,  17, -23,
-    -6,   7,  26,  31,  65,  56,  25, -20,
-    98, 134,  61,  95,  68, 126,  34, -11,
-     0,   0,   0,   0,   0,   0,   0,   0,
-};
-
-int pawn_table_eg[SQUARE_NO] = {
-      0,   0,   0,   0,   0,   0,   0,   0,
-      0,   0,   0,   0,   0,   0,   0,   0,
-     13,   8,   8,  10,  13,   0,   2,  -7,
-      4,   7,  -6,   1,   0,  -5,  -1,  -8,
-     13,   9,  -3,  -7,  -7,  -8,   3,  -1,
-     32,  24,  13,   5,  -2,   4,  17,  17,
-     94, 100,  85,  67,  56,  53,  82,  84,
-    178, 173, 158, 134, 147, 132, 165, 187,
-};
-
-int knight_table_mg[SQUARE_NO] = {
-    -105, -21, -58, -33, -17,  -28, -19, -23, -29, -53, -12, -3,  -1,
-    18,   -14, -19, -23, -9,   12,  10,  19,  17,  25,  -16, -13, 4,
-    16,   13,  28,  19,  21,   -8,  -9,  17,  19,  53,  37,  69,  18,
-    22,   -47, 60,  37,  65,   84,  129, 73,  44,  -73, -41, 72,  36,
-    23,   62,  7,   -17, -167, -89, -34, -49, 61,  -97, -15, -107
-};
-
-int knight_table_eg[SQUARE_NO] = {
-    -29, -51, -23, -15, -22, -18, -50, -64, -42, -20, -10, -5,  -2,
-    -20, -23, -44, -23, -3,  -1,  15,  10,  -3,  -20, -22, -18, -6,
-    16,  25,  16,  17,  4,   -18, -17, 3,   22,  22,  22,  11,  8,
-    -18, -24, -20, 10,  9,   -1,  -9,  -19, -41, -25, -8,  -25, -2,
-    -9,  -25, -24, -52, -58, -38, -13, -28, -31, -27, -63, -99
-};
-
-int bishop_table_mg[SQUARE_NO]{
-    -33, -3, -14, -21, -13, -12, -39, -21, 4,   15, 16,  0,   7,   21,  33, 1,
-    0,   15, 15,  15,  14,  27,  18,  10,  -6,  13, 13,  26,  34,  12,  10, 4,
-    -4,  5,  19,  50,  37,  37,  7,   -2,  -16, 37, 43,  40,  35,  50,  37, -2,
-    -26, 16, -18, -13, 30,  59,  18,  -47, -29, 4,  -82, -37, -25, -42, 7,  -8
-};
-
-int bishop_table_eg[SQUARE_NO]{
-    -23, -9, -23, -5,  -9, -16, -5, -17, -14, -18, -7,  -1, 4,  -9, -15, -27,
-    -12, -3, 8,   10,  13, 3,   -7, -15, -6,  3,   13,  19, 7,  10, -3,  -9,
-    -3,  9,  12,  9,   14, 10,  3,  2,   2,   -8,  0,   -1, -2, 6,  0,   4,
-    -8,  -4, 7,   -12, -3, -13, -4, -14, -14, -21, -11, -8, -7, -9, -17, -24
-};
-
-int rook_table_mg[SQUARE_NO]{
-    -19, -13, 1,   17,  16, 7,  -37, -26, -44, -16, -20, -9, -1, 11, -6, -71,
-    -45, -25, -16, -17, 3,  0,  -5,  -33, -36, -26, -12, -1, 9,  -7, 6,  -23,
-    -24, -11, 7,   26,  24, 35, -8,  -20, -5,  19,  26,  36, 17, 45, 61, 16,
-    27,  32,  58,  62,  80, 67, 26,  44,  32,  42,  32,  51, 63, 9,  31, 43
-};
-
-int rook_table_eg[SQUARE_NO]{
-    -9, 2,  3,  -1, -5, -13, 4,  -20, -6, -6, 0,  2,  -9, -9, -11, -3,
-    -4, 0,  -5, -1, -7, -12, -8, -16, 3,  5,  8,  4,  -5, -6, -8,  -11,
-    4,  3,  13, 1,  2,  1,   -1, 2,   7,  7,  7,  5,  4,  -3, -5,  -3,
-    11, 13, 13, 11, -3, 3,   8,  3,   13, 10, 18, 15, 12, 12, 8,   5
-};
-
-int queen_table_mg[SQUARE_NO]{
-    -1,  -18, -9,  10,  -15, -25, -31, -50, -35, -8,  11, 2,   8,  15, -3, 1,
-    -14, 2,   -11, -2,  -5,  2,   14,  5,   -9,  -26, -9, -10, -2, -4, 3,  -3,
-    -27, -27, -16, -16, -1,  17,  -2,  1,   -13, -17, 7,  8,   29, 56, 47, 57,
-    -24, -39, -5,  1,   -16, 57,  28,  54,  -28, 0,   29, 12,  59, 44, 43, 45
-};
-
-int queen_table_eg[SQUARE_NO]{
-    -33, -28, -22, -43, -5,  -32, -20, -41, -22, -23, -30, -16, -16,
-    -23, -36, -32, -16, -27, 15,  6,   9,   17,  10,  5,   -18, 28,
-    19,  47,  31,  34,  39,  23,  3,   22,  24,  45,  57,  40,  57,
-    36,  -20, 6,   9,   49,  47,  35,  19,  9,   -17, 20,  32,  41,
-    58,  25,  30,  0,   -9,  22,  22,  27,  27,  19,  10,  20
-};
-
-int king_table_mg[SQUARE_NO] = {
-    -15, 36,  12,  -54, 8,   -28, 24,  14,  1,   7,   -8,  -64, -43,
-    -16, 9,   8,   -14, -14, -22, -46, -44, -30, -15, -27, -49, -1,
-    -27, -39, -46, -44, -33, -51, -17, -20, -12, -27, -30, -25, -14,
-    -36, -9,  24,  2,   -16, -20, 6,   22,  -22, 29,  -1,  -20, -7,
-    -8,  -4,  -38, -29, -65, 23,  16,  -15, -56, -34, 2,   13
-};
-
-int king_table_eg[SQUARE_NO] = {
-    -53, -34, -21, -11, -28, -14, -24, -43, -27, -11, 4,  13,  14,
-    4,   -5,  -17, -19, -3,  11,  21,  23,  16,  7,   -9, -18, -4,
-    21,  24,  27,  23,  9,   -11, -8,  22,  24,  27,  26, 33,  26,
-    3,   10,  17,  23,  15,  20,  45,  44,  13,  -12, 17, 14,  17,
-    17,  38,  23,  11,  -74, -35, -18, -18, -11, 15,  4,  -17
-};
-
-// TOGA Log Manual inspired
-int knight_outposts_mg[SQUARE_NO] = {
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 3, 4, 4, 3, 0, 0,
-    0, 2, 4, 8, 8, 4, 2, 0,
-    0, 2, 4, 8, 8, 4, 2, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-};
-
-int knight_outposts_eg[SQUARE_NO] = {
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 2, 3, 3, 2, 0, 0,
-    0, 1, 2, 4, 4, 2, 1, 0,
-    0, 1, 2, 4, 4, 2, 1, 0,
-    0, 0, 1, 1, 1, 1, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-};
-
+// Margin of the lazy evaluation, see evaluate()
+int lazy_eval_margin = LAZY_MARGIN;
+
+// Material + PSQT scores of the pieces from White's POV, see init_psqt()
+score_t psqt[PIECE_NO][SQUARE_NO];
+
+void init_psqt() {
+    const score_t *tables[] = {
+        nullptr, pawn_psqt, knight_psqt, bishop_psqt, rook_psqt, queen_psqt, king_psqt
+    };
+    for (piece_t pce : pieces) {
+        for (square_t sq = A1; sq <= H8; ++sq) {
+            // The kings are scored by the king safety terms only
+            if (piece_type(pce) == KING) {
+                psqt[pce][sq] = S(0, 0);
+            } else if (piece_color(pce) == WHITE) {
+                psqt[pce][sq] = S(value_mg[pce], value_eg[pce]) + tables[piece_type(pce)][sq];
+            } else {
+                psqt[pce][sq] = -S(value_mg[pce], value_eg[pce]) - tables[piece_type(pce)][mirror(sq)];
+            }
+        }
+    }
+}
 
 namespace {
 
-// Array of pointers to arrays
-constexpr const int *psqt_mg[] = {
-    nullptr, // NO_PIECE
-    pawn_table_mg,
-    knight_table_mg,
-    bishop_table_mg,
-    rook_table_mg,
-    queen_table_mg,
-    king_table_mg,
-    nullptr,
-    nullptr,
-    pawn_table_mg,
-    knight_table_mg,
-    bishop_table_mg,
-    rook_table_mg,
-    queen_table_mg,
-    king_table_mg,
-};
-
-constexpr const int *psqt_eg[] = {
-    nullptr, // NO_PIECE
-    pawn_table_eg,
-    knight_table_eg,
-    bishop_table_eg,
-    rook_table_eg,
-    queen_table_eg,
-    king_table_eg,
-    nullptr,
-    nullptr,
-    pawn_table_eg,
-    knight_table_eg,
-    bishop_table_eg,
-    rook_table_eg,
-    queen_table_eg,
-    king_table_eg,
-};
+/* Colour-relative directions & masks, resolved at compile time */
+
+// Pawn of the side
+template<int COLOUR>
+constexpr piece_t PAWN_OF = COLOUR == WHITE ? P : p;
+
+// Shifts towards the opponent's side of the board
+template<int COLOUR>
+inline bb_t forward(const bb_t bb) {
+    return COLOUR == WHITE ? n_shift(bb) : s_shift(bb);
+}
+
+// Shifts towards the side's own side of the board
+template<int COLOUR>
+inline bb_t backward(const bb_t bb) {
+    return COLOUR == WHITE ? s_shift(bb) : n_shift(bb);
+}
+
+// Squares attacked by the side's pawns on bb
+template<int COLOUR>
+inline bb_t pawn_attacks(const bb_t bb) {
+    return COLOUR == WHITE ? ne_shift(bb) | nw_shift(bb)
+                           : se_shift(bb) | sw_shift(bb);
+}
+
+// Squares in front of the pawn on sq (on its & the adjacent files)
+template<int COLOUR>
+inline bb_t passed_mask(const square_t sq) {
+    return COLOUR == WHITE ? wPassedMask[sq] : bPassedMask[sq];
+}
+
+// The square as seen from White's side (for indexing White's tables)
+template<int COLOUR>
+inline square_t relative_square(const square_t sq) {
+    return COLOUR == WHITE ? sq : mirror(sq);
+}
 
 /* Pawn structure helpers */
 
 // Friendly pawns on the same rank & adjacent files
 // for the pawn on square sq
+template<int COLOUR>
 inline bool is_phalanx(const board_t *board, const square_t sq) {
-    // To avoid color setting logic
-    const piece_t &p = board->pieces[sq];
     bb_t tmp = SQ_TO_BB(sq);
-    return (e_shift(tmp) | w_shift(tmp)) & board->bitboards[p];
+    return (e_shift(tmp) | w_shift(tmp)) & board->bitboards[PAWN_OF<COLOUR>];
 }
 
 // # of friendly pawns supporting the pawn on square sq
+template<int COLOUR>
 inline int is_supported(const board_t *board, const square_t sq) {
-   const piece_t &pce = board->pieces[sq];
-   bb_t tmp = SQ_TO_BB(sq);
-   if (piece_color(pce) == WHITE) {
-       return CNT((se_shift(tmp) | sw_shift(tmp)) & board->bitboards[pce]);
-   } else {
-       return CNT((ne_shift(tmp) | nw_shift(tmp)) & board->bitboards[pce]);
-   }
+    return CNT(pawn_attacks<COLOUR ^ 1>(SQ_TO_BB(sq)) & board->bitboards[PAWN_OF<COLOUR>]);
 }
 
 // Whether the opponent has a sentry pawn blocking the passage
 // of a pawn on square sq
+template<int COLOUR>
 inline bool is_opposed(const board_t *board, const square_t sq) {
-    // TODO: Collapse implementation for white and black with flip_colour()
-    const piece_t &pce = board->pieces[sq];
-    if (piece_color(pce) == WHITE) {
-       return (wPassedMask[sq] & fileBBMask[SQUARE_FILE(sq)]) &
-              board->bitboards[p];
-    } else {
-        return (bPassedMask[sq] & fileBBMask[SQUARE_FILE(sq)]) &
-              board->bitboards[P];
-    }
+    return (passed_mask<COLOUR>(sq) & fileBBMask[SQUARE_FILE(sq)]) &
+           board->bitboards[PAWN_OF<COLOUR ^ 1>];
 }
 
 // Whether the pawn on sq is connected to other friendly pawns, and if yes,
@@ -289,19 +112,18 @@ inline bool is_opposed(const board_t *board, const square_t sq) {
 // Note that friendly pawns cannot be on RANK0 and cannot be
 // supported by any other pawn on RANK1, hence the zeroes in the pawn_bonuses
 // array
-inline int pawn_struct_score(const board_t *board, const square_t sq) {
-    const piece_t &p = board->pieces[sq];
-
-    int supporting = is_supported(board, sq); // # of supporting pawns
-    int phalanx = is_phalanx(board, sq);
+template<int COLOUR>
+inline score_t pawn_struct_score(const board_t *board, const square_t sq) {
+    int supporting = is_supported<COLOUR>(board, sq); // # of supporting pawns
+    int phalanx = is_phalanx<COLOUR>(board, sq);
 
     // If the pawn is disconnected from other friendly pawns on the board
     if (supporting + phalanx == 0)
         return 0;
 
     return pawn_supported * supporting +
-            pawn_bonuses[SQUARE_RANK_FOR(piece_color(p), sq)] *
-                (2 + phalanx - is_opposed(board, sq));
+            pawn_bonuses[SQUARE_RANK_FOR(COLOUR, sq)] *
+                (2 + phalanx - is_opposed<COLOUR>(board, sq));
 }
 
 // We define the king danger zone as the squares to which the King
@@ -327,48 +149,55 @@ bb_t get_king_zone(const board_t *board, const int colour) {
     return king_zone;
 }
 
-// King safety score for the 'colour' king during the middle game
-// - pawn shield (king's file + 2 adjacent files)
-// - pawn storm (opponent's pawn advances on the same 3 files)
-// - piece attack score (number of attackers)
-int king_safety_score(const board_t *board, const int colour, int attackers) {
-    // TODO: Collapse implementation using templates
-
-    /* Setup */
-    int score = 0;
-    // Bitboard masks for finding friendly shielding pawns
-    bb_t pawns1 = 0ULL, pawns2 = 0ULL;
-    // Bitboard mask for evaluating the enemy's pawn storm
-    // bb_t storming_pawns = 0ULL;
+// Counts the friendly pawns shielding the 'COLOUR' king (king's file + 2
+// adjacent files): right in front of the king & one rank further
+template<int COLOUR>
+void pawn_shield(const board_t *board, int shield[2]) {
     // King's friendly pawns bitboard
-    bb_t king_pawns = pawns(board) & board->sides_pieces[colour];
-    bb_t king_bb = king_square_bb(board, colour);
+    bb_t king_pawns = board->bitboards[PAWN_OF<COLOUR>];
+    bb_t king_bb = king_square_bb(board, COLOUR);
 
     /* Pawn shields: we score pawns immediately next to the king higher than
         pushed pawns */
-    if (colour == WHITE) {
-        pawns1 = ne_shift(king_bb) | n_shift(king_bb) | nw_shift(king_bb);
-        pawns2 = n_shift(pawns1);
+    bb_t pawns1 = pawn_attacks<COLOUR>(king_bb) | forward<COLOUR>(king_bb);
+    bb_t pawns2 = forward<COLOUR>(pawns1);
+    // REVIEW: Enemy pawn storm (disabled, see king_safety_score())
+    // bb_t storming_pawns = board->bitboards[PAWN_OF<COLOUR ^ 1>] &
+    //                       passed_mask<COLOUR>(king_square(board, COLOUR));
 
-        //storming_pawns = board->bitboards[p] & wPassedMask[king_square(board, colour)];
-    } else {
-        pawns1 = se_shift(king_bb) | s_shift(king_bb) | sw_shift(king_bb);
-        pawns2 = s_shift(pawns1);
+    // Extract the shielding pawns from the current position
+    shield[0] = CNT(pawns1 & king_pawns);
+    shield[1] = CNT(pawns2 & king_pawns);
+}
 
-        //storming_pawns = board->bitboards[P] & bPassedMask[king_square(board, colour)];
+// Returns the pawn shield of the 'COLOUR' king, cached in the pawn hash
+// entry for the king's square
+template<int COLOUR>
+const int *king_shield(const board_t *board, pawn_entry_t *entry) {
+    const square_t king_sq = king_square(board, COLOUR);
+    if (entry->king_sq[COLOUR] != king_sq) {
+        entry->king_sq[COLOUR] = king_sq;
+        pawn_shield<COLOUR>(board, entry->shield[COLOUR]);
     }
+    return entry->shield[COLOUR];
+}
 
-    // Extract the shielding pawns from the current position
-    pawns1 &= king_pawns;
-    pawns2 &= king_pawns;
+// King safety score for the 'COLOUR' king during the middle game
+// - pawn shield (king's file + 2 adjacent files), see pawn_shield()
+// - pawn storm (opponent's pawn advances on the same 3 files)
+// - piece attack score (number of attackers)
+template<int COLOUR>
+int king_safety_score(const board_t *board, pawn_entry_t *entry, int attackers) {
+    const int *shield = king_shield<COLOUR>(board, entry);
+    int score = 0;
 
     // We score the pawns further away from the king less
-    score += CNT(pawns1) * PAWN_SHIELD1_BONUS;
-    score += CNT(pawns2) * PAWN_SHIELD2_BONUS;
+    score += shield[0] * PAWN_SHIELD1_BONUS;
+    score += shield[1] * PAWN_SHIELD2_BONUS;
 
     // King safety based on attackers
-    attackers -= 2 * CNT(pawns1);
-    attackers -= 1 * CNT(pawns2);
+    attackers -= 2 * shield[0];
+    attackers -= 1 * shield[1];
     score -= KING_SAFETY_TABLE[MAX(0, MIN(attackers, 49))];
 
     // Enemy pawn storm: penalty for hostile pawns on king's files
@@ -376,7 +205,7 @@ int king_safety_score(const board_t *board, const int colour, int attackers) {
     // - we only consider pawnes on ranks 4..7 (relati)
     // REVIEW: Seems to be losing elo?
     //while (storming_pawns) {
-        //score -= ((3 * (SQUARE_RANK_FOR(colour, POPLSB(storming_pawns)) - 2) ) / 2) * PAWN_STORM_PENALTY;
+        //score -= ((3 * (SQUARE_RANK_FOR(COLOUR, POPLSB(storming_pawns)) - 2) ) / 2) * PAWN_STORM_PENALTY;
     //}
 
     return score;
@@ -397,106 +226,38 @@ int king_safety_score(const board_t *board, const int colour, int attackers) {
 }
 
 
-// Originally from sjeng 11.2 (adapted from Vice 1.1)
-int material_draw(const board_t *board) {
-    assert(check(board));
-
-    int qs = CNT(queens(board));
-    int rs = CNT(rooks(board));
-    int bs = CNT(bishops(board));
-    int ns = CNT(knights(board));
-
-    int white_rs = CNT(board->bitboards[R]);
-    int black_rs = CNT(board->bitboards[r]);
-
-    int white_bs = CNT(board->bitboards[B]);
-    int black_bs = CNT(board->bitboards[b]);
+/**
+ * @brief Evaluates the pawns of a side (isolated, passed, doubled and
+ * connected pawns) and records its passed pawns & pawn attacks
+ * @tparam COLOUR side to evaluate
+ * @param board current position
+ * @param entry pawn hash entry being filled in
+ * @return score from the side's POV
+ */
+template<int COLOUR>
+score_t evaluate_pawns_for(const board_t *board, pawn_entry_t *entry) {
+    const bb_t our_pawns = board->bitboards[PAWN_OF<COLOUR>];
+    const bb_t their_pawns = board->bitboards[PAWN_OF<COLOUR ^ 1>];
+    score_t score = 0;
 
-    int white_ns = CNT(board->bitboards[N]);
-    int black_ns = CNT(board->bitboards[n]);
+    entry->attacks[COLOUR] = pawn_attacks<COLOUR>(our_pawns);
 
-    if (!rs && !qs) {
-	  if (!bs) {
-	      if (black_ns < 3 && white_ns < 3) {  return 1; }
-	  } else if (!ns) {
-	     if (abs(white_bs - black_bs) < 2) { return 1; }
-	  } else if ((white_ns < 3 && !white_bs) || (white_bs == 1 && !white_ns)) {
-	    if ((black_ns < 3 && !black_bs) || (black_bs == 1 && !black_ns)) { return 1; }
-	  }
-	} else if (!qs) {
-        if (white_rs == 1 && black_rs == 1) {
-            if ((white_ns + white_bs) < 2 && (black_ns + black_bs) < 2) { return 1; }
-        } else if (white_rs == 1 && !black_rs) {
-            if ((white_ns + white_bs == 0) && (((black_ns + black_bs) == 1) || ((black_ns + black_bs) == 2))) { return 1; }
-        } else if (black_rs == 1 && !white_rs) {
-            if ((black_ns + black_bs == 0) && (((white_ns + white_bs) == 1) || ((white_ns + white_bs) == 2))) { return 1; }
-        }
-    }
-    return 0;
-}
-
-
-} // namespace
-
-
-// Evaluates the position from the side's POV
-int evaluate(const board_t *board, eval_t * eval) {
-    assert(check(board));
-
-    /* Setup */
-    eval->middlegame = 0;
-    eval->endgame = 0;
-    eval->set_phase(board);
-    int score = 0;
-    bb_t occupied = all_pieces(board);
-
-    if (!pawns(board) && material_draw(board)) {
-        return 0;
-    }
-
-    square_t sq;
-    // During evaluation we incrementally build up the attack maps for both sides
-    bb_t sides_attacks[BOTH] = {0ULL, 0ULL};
-
-    /* Pawn structure */
-
-    bb_t black_pawns = board->bitboards[p];
-    bb_t white_pawns = board->bitboards[P];
-    bb_t pawns = black_pawns | white_pawns;
-    bb_t bb = white_pawns;
-
-    /* Setup for pawn protected pieces */
-    bb_t pawn_protected[BOTH] = {se_shift(black_pawns) | sw_shift(black_pawns),
-                                 ne_shift(white_pawns) | nw_shift(white_pawns)};
-
-    // (White pawns)
-    // Pawn values
-    eval->middlegame += CNT(bb) * value_mg[P];
-    eval->endgame    += CNT(bb) * value_eg[P];
+    // (pawn values & PSQTs are accumulated in the board)
     // Passed & isolated pawns
+    bb_t bb = our_pawns;
     while (bb) {
-        // Get the square of a white pawn
-        sq = POPLSB(bb);
-
-        // PSQTs
-        eval->middlegame += pawn_table_mg[sq];
-        eval->endgame    += pawn_table_eg[sq];
+        square_t sq = POPLSB(bb);
 
         // Isolated pawns penalty
-        if ((white_pawns & isolatedMask[sq]) == 0) {
-            eval->middlegame += isolated_pawn;
-            eval->endgame    += isolated_pawn;
+        if ((our_pawns & isolatedMask[sq]) == 0) {
+            score += isolated_pawn;
         }
 
-        // Pass pawns bonus  /* black pawns */
-        if ((black_pawns & wPassedMask[sq]) == 0) {
-            eval->middlegame += passed_pawn[SQUARE_RANK(sq)];
-            eval->endgame    += passed_pawn[SQUARE_RANK(sq)];
-
-            // In addition, in the endgame we encourage the king to protect the pawn
-            eval->endgame +=  KING_PAWN_DIST_BONUS*(6 - dist(sq, king_square(board, WHITE)));
-            // ...we also give a bonus for how far away from the pawn the enemy king is
-            eval->endgame += -KING_PAWN_DIST_BONUS*(6 - dist(sq, king_square(board, BLACK)));
+        // Pass pawns bonus
+        if ((their_pawns & passed_mask<COLOUR>(sq)) == 0) {
+            score += passed_pawn[SQUARE_RANK_FOR(COLOUR, sq)];
+            // (the kings' distance to the pawn is evaluated in evaluate())
+            SETBIT(entry->passed[COLOUR], sq);
         }
 
         // Candidate pawns (defined the same was as in Toga)
@@ -504,11 +265,11 @@ int evaluate(const board_t *board, eval_t * eval) {
         //-if # of enemy pawns on same and neighboring files is <= than # of friendly pawns on the same files
         //-if # of attacking pawns is less or equal to the number of protecting pawns
         /*
-        if ((fileBBMask[SQUARE_FILE(sq)] & black_pawns) == 0 &&
-            CNT(wPassedMask[sq] & black_pawns) <= CNT(n_shift(bPassedMask[sq]) & white_pawns) &&
-            CNT(pawn_protected[WHITE] & black_pawns) <= CNT(bPassedMask[sq] & rankBBMask[SQUARE_RANK(sq) - 1])) {
-            eval->middlegame +=  5 + passed_pawn[SQUARE_RANK(sq)] / 10;
-            eval->endgame    += 10 + passed_pawn[SQUARE_RANK(sq)] / 5;
+        if ((fileBBMask[SQUARE_FILE(sq)] & their_pawns) == 0 &&
+            CNT(passed_mask<COLOUR>(sq) & their_pawns) <= CNT(forward<COLOUR>(passed_mask<COLOUR ^ 1>(sq)) & our_pawns) &&
+            CNT(entry->attacks[COLOUR] & their_pawns) <= CNT(passed_mask<COLOUR ^ 1>(sq) & rankBBMask[SQUARE_RANK(sq) - (COLOUR == WHITE ? 1 : -1)])) {
+            score += S( 5 + mg_value(passed_pawn[SQUARE_RANK_FOR(COLOUR, sq)]) / 10,
+                       10 + eg_value(passed_pawn[SQUARE_RANK_FOR(COLOUR, sq)]) / 5);
         }
         */
 
@@ -516,190 +277,96 @@ int evaluate(const board_t *board, eval_t * eval) {
         // - if there's a pawn immediatley behind this one && the pawn isn't
         //   supported
         bb_t tmp = SQ_TO_BB(sq);
-        if ((s_shift(tmp) & white_pawns) &&
-            ((se_shift(tmp) | sw_shift(tmp)) & white_pawns) == 0ULL) {
-            eval->middlegame += doubled_pawn;
-            eval->endgame    += doubled_pawn;
+        if ((backward<COLOUR>(tmp) & our_pawns) &&
+            (pawn_attacks<COLOUR ^ 1>(tmp) & our_pawns) == 0ULL) {
+            score += doubled_pawn;
         }
 
         // Whether the pawn is connected to friendly pawns
         // (supported || phalanx) + penalty for opposed pawns
-        int connected_bonus = pawn_struct_score(board, sq);
-        eval->middlegame += connected_bonus;
-        eval->endgame    += connected_bonus;
+        score += pawn_struct_score<COLOUR>(board, sq);
     }
+    return score;
+}
 
-    // (Black pawns)
-    // Pawn values
-    bb = black_pawns;
-    eval->middlegame -= CNT(bb) * value_mg[p];
-    eval->endgame    -= CNT(bb) * value_eg[p];
-    while (bb) {
-        // Get the square of a black pawn
-        sq = POPLSB(bb);
-
-        // PSQTs
-        eval->middlegame -= pawn_table_mg[mirror(sq)];
-        eval->endgame    -= pawn_table_eg[mirror(sq)];
-
-        // Isolated pawns
-        if ((black_pawns & isolatedMask[sq]) == 0) {
-            eval->middlegame -= isolated_pawn;
-            eval->endgame    -= isolated_pawn;
-        }
-
-        // Pass pawns  /* white pawns */
-        if ((white_pawns & bPassedMask[sq]) == 0) {
-            eval->middlegame -= passed_pawn[SQUARE_RANK(mirror(sq))];
-            eval->endgame    -= passed_pawn[SQUARE_RANK(mirror(sq))];
-
-            // In addition, in the endgame we encourage the king to protect the pawn
-            eval->endgame -=  KING_PAWN_DIST_BONUS*(6 - dist(sq, king_square(board, BLACK)));
-            // ...we also give a bonus for how far away from the pawn the enemy king is
-            eval->endgame -= -KING_PAWN_DIST_BONUS*(6 - dist(sq, king_square(board, WHITE)));
-        }
-
-        // Candidate pawns (defined the same was as in Toga)
-        //-if is open
-        //-if # of enemy pawns on same and neighboring files is <= than # of friendly pawns on the same files
-        //-if # of attacking pawns is less or equal to the number of protecting pawns
-        /*
-        if ((fileBBMask[SQUARE_FILE(sq)] & white_pawns) == 0 &&
-            CNT(bPassedMask[sq] & white_pawns) <= CNT(s_shift(wPassedMask[sq]) & black_pawns) &&
-            CNT(pawn_protected[BLACK] & white_pawns) <= CNT(wPassedMask[sq] & rankBBMask[SQUARE_RANK(sq) + 1])) {
-            eval->middlegame -=  5 + passed_pawn[SQUARE_RANK_FOR(BLACK, sq)] / 10;
-            eval->endgame    -= 10 + passed_pawn[SQUARE_RANK_FOR(BLACK, sq)] / 5;
-        }
-        */
+// Evaluates the terms depending on the pawns only into a pawn hash entry
+void evaluate_pawns(const board_t *board, pawn_entry_t *entry) {
+    *entry = pawn_entry_t{};
+    entry->key = board->pawn_key;
+    entry->score = evaluate_pawns_for<WHITE>(board, entry) -
+                   evaluate_pawns_for<BLACK>(board, entry);
+}
 
-        // Doubled pawn penalty
-        // - if there's a pawn immediatley behind this one && the pawn isn't
-        //   supported
-        bb_t tmp = SQ_TO_BB(sq);
-        if ((n_shift(tmp) & black_pawns) &&
-            ((ne_shift(tmp) | nw_shift(tmp)) & black_pawns) == 0ULL) {
-            eval->middlegame -= doubled_pawn;
-            eval->endgame    -= doubled_pawn;
-        }
+/**
+ * @brief Evaluates the pieces of a side: pieces protected by pawns, rooks &
+ * queens on (semi-)open files, mobility & attacks on the enemy king zone,
+ * the king's proximity to passed pawns and the bishop pair
+ * @tparam COLOUR side to evaluate
+ * @param board current position
+ * @param pawn_entry pawn hash entry of the position
+ * @param material_entry material hash entry of the position
+ * @param sides_attacks squares attacked by each side, the side's attacks
+ * are added to it
+ * @param king_attacks weighted attacks on the opponent's king zone
+ * @return score from the side's POV
+ */
+template<int COLOUR>
+score_t evaluate_pieces(const board_t *board, const pawn_entry_t *pawn_entry,
+                        const material_entry_t *material_entry,
+                        bb_t sides_attacks[BOTH], int *king_attacks) {
+    constexpr int THEM = COLOUR ^ 1;
+    const bb_t our_pawns = board->bitboards[PAWN_OF<COLOUR>];
+    const bb_t their_pawns = board->bitboards[PAWN_OF<THEM>];
+    const bb_t pawns = our_pawns | their_pawns;
+    const bb_t occupied = all_pieces(board);
+    score_t score = 0;
+    square_t sq;
 
-        // Whether the pawn is connected to friendly pawns
-        // (supported || phalanx) + penalty for opposed pawns
-        int connected_bonus = pawn_struct_score(board, sq);
-        eval->middlegame -= connected_bonus;
-        eval->endgame    -= connected_bonus;
+    // In the endgame we encourage the king to protect the passed pawns, and
+    // we also give a bonus for how far away from them the enemy king is
+    bb_t bb = pawn_entry->passed[COLOUR];
+    while (bb) {
+        sq = POPLSB(bb);
+        score +=  KING_PAWN_DIST_BONUS*(6 - dist(sq, king_square(board, COLOUR)));
+        score += -KING_PAWN_DIST_BONUS*(6 - dist(sq, king_square(board, THEM)));
     }
 
-
-    /* Major pieces */
-
-    // White
-
     /* Setup for king safety eval */
     // King zone of the king we're attacking
-    bb_t king_zone = get_king_zone(board, BLACK);
-    bb_t king_attacks_score[BOTH] = {0, 0};
+    const bb_t king_zone = get_king_zone(board, THEM);
 
-    // PSQTs + Material value
-    bb  = board->sides_pieces[WHITE];
-    bb ^= white_pawns;
-    bb ^= board->bitboards[K];
+    // Pieces (other than pawns & the king)
+    bb  = board->sides_pieces[COLOUR];
+    bb ^= our_pawns;
+    bb ^= board->bitboards[set_colour(K, COLOUR)];
 
     // We give a small bonus for each piece protected by a pawn
-    eval->middlegame += CNT(bb & pawn_protected[WHITE]) * pawn_protected_bonus;
-    eval->endgame    += CNT(bb & pawn_protected[WHITE]) * pawn_protected_bonus;
+    score += CNT(bb & pawn_entry->attacks[COLOUR]) * pawn_protected_bonus;
 
-    // Include opponent's pawn attacks in their incrementally updated attack bitboard
-    sides_attacks[BLACK] |= pawn_protected[BLACK];
-    sides_attacks[WHITE] |= pawn_protected[WHITE];
+    // Include our pawn attacks in the incrementally updated attack bitboard
+    sides_attacks[COLOUR] |= pawn_entry->attacks[COLOUR];
 
-    piece_t pce;
-    bb_t attacks_bb;
     while (bb) {
         sq = POPLSB(bb);
-        pce = board->pieces[sq];
-        eval->middlegame += value_mg[pce];
-        eval->middlegame += psqt_mg[pce][sq];
-        eval->endgame    += value_eg[pce];
-        eval->endgame    += psqt_eg[pce][sq];
+        const piece_t pce = board->pieces[sq];
         // In addition to piece values and psqts, we reward pieces on open files
         switch (piece_type(pce)) {
             case QUEEN:
                 // Is on open file?
                 if (not (pawns & fileBBMask[SQUARE_FILE(sq)])) {
-                    eval->middlegame += queen_open_file;
-                    eval->endgame += queen_open_file;
+                    score += queen_open_file;
                 // Is on semi-open file?
-                } else if (not (black_pawns & fileBBMask[SQUARE_FILE(sq)])) {
-                    eval->middlegame += queen_semiopen_file;
-                    eval->endgame += queen_semiopen_file;
+                } else if (not (their_pawns & fileBBMask[SQUARE_FILE(sq)])) {
+                    score += queen_semiopen_file;
                 }
                 break;
             case ROOK:
                 // Is on open file?
                 if (not (pawns & fileBBMask[SQUARE_FILE(sq)])) {
-                    eval->middlegame += rook_open_file;
-                    eval->endgame += rook_open_file;
-                // Is on semi-open file?
-                } else if (not (black_pawns & fileBBMask[SQUARE_FILE(sq)])) {
-                    eval->middlegame += rook_semiopen_file;
-                    eval->endgame += rook_semiopen_file;
-                }
-                break;
-            default:
-                break;
-        }
-
-        // Mobility and attacks on the enemy king
-        attacks_bb = attacks(pce, sq, occupied);
-        sides_attacks[WHITE] |= attacks_bb;
-
-        king_attacks_score[BLACK] +=
-            KING_ATTACK_WEIGHT[pce] * CNT(king_zone & attacks_bb);
-        eval->middlegame += CNT(attacks_bb) * mobility_weights[pce];
-        eval->endgame    += CNT(attacks_bb) * mobility_weights[pce];
-    }
-
-    // Black
-    king_zone = get_king_zone(board, WHITE);
-
-    // PSQTs + Material value
-    bb  = board->sides_pieces[BLACK];
-    bb ^= black_pawns;
-    bb ^= board->bitboards[k];
-
-    // We give a small bonus for each piece protected by a pawn
-    eval->middlegame -= CNT(bb & pawn_protected[BLACK]) * pawn_protected_bonus;
-    eval->endgame    -= CNT(bb & pawn_protected[BLACK]) * pawn_protected_bonus;
-
-    while (bb) {
-        sq = POPLSB(bb);
-        pce = board->pieces[sq];
-        eval->middlegame -= value_mg[pce];
-        eval->middlegame -= psqt_mg[pce][mirror(sq)];
-        eval->endgame    -= value_eg[pce];
-        eval->endgame    -= psqt_eg[pce][mirror(sq)];
-        // In addition to piece values and psqts, we reward pieces on open files
-        switch (piece_type(pce)) {
-            case QUEEN:
-                // Is on open file?
-                if (not (pawns & fileBBMask[SQUARE_FILE(mirror(sq))])) {
-                    eval->middlegame -= queen_open_file;
-                    eval->endgame -= queen_open_file;
+                    score += rook_open_file;
                 // Is on semi-open file?
-                } else if (not (white_pawns & fileBBMask[SQUARE_FILE(mirror(sq))])) {
-                    eval->middlegame -= queen_semiopen_file;
-                    eval->endgame -= queen_semiopen_file;
-                }
-                break;
-            case ROOK:
-                // Is on open file?
-                if (not (pawns & fileBBMask[SQUARE_FILE(mirror(sq))])) {
-                    eval->middlegame -= rook_open_file;
-                    eval->endgame -= rook_open_file;
-                // Is on semi-open file?
-                } else if (not (white_pawns & fileBBMask[SQUARE_FILE(mirror(sq))])) {
-                    eval->middlegame -= rook_semiopen_file;
-                    eval->endgame -= rook_semiopen_file;
+                } else if (not (their_pawns & fileBBMask[SQUARE_FILE(sq)])) {
+                    score += rook_semiopen_file;
                 }
                 break;
             default:
@@ -707,40 +374,18 @@ int evaluate(const board_t *board, eval_t * eval) {
         }
 
         // Mobility and attacks on the enemy king
-        attacks_bb = attacks(pce, sq, occupied);
-        sides_attacks[BLACK] |= attacks_bb;
-
-        king_attacks_score[WHITE] +=
-            KING_ATTACK_WEIGHT[pce] * CNT(king_zone & attacks_bb);
+        const bb_t attacks_bb = attacks(pce, sq, occupied);
+        sides_attacks[COLOUR] |= attacks_bb;
 
-        eval->middlegame -= CNT(attacks_bb) * mobility_weights[pce];
-        eval->endgame    -= CNT(attacks_bb) * mobility_weights[pce];
+        *king_attacks += KING_ATTACK_WEIGHT[pce] * CNT(king_zone & attacks_bb);
+        score += CNT(attacks_bb) * mobility_weights[pce];
     }
 
     /* Bishop pair bonus */
     // We make sure the bishops are of opposite colors
-
-    // White
-    bb = board->bitboards[B];
-    int on_white = 0, on_black = 0;
-    if (CNT(bb) >= 2) { // If two bishops on board
-        while (bb) {
-            if (is_white(POPLSB(bb))) {
-                on_white += 1;
-            } else {
-                on_black += 1;
-            }
-        }
-        if (on_white >= 1 && on_black >= 1) {
-            eval->middlegame += bishop_pair_mg;
-            eval->endgame    += bishop_pair_eg;
-        }
-    }
-
-    // Black
-    bb = board->bitboards[b];
-    on_white = on_black = 0;
-    if (CNT(bb) >= 2) { // If two bishops on board
+    if (material_entry->bishops[COLOUR]) { // If two bishops on board
+        bb = board->bitboards[set_colour(B, COLOUR)];
+        int on_white = 0, on_black = 0;
         while (bb) {
             if (is_white(POPLSB(bb))) {
                 on_white += 1;
@@ -749,51 +394,187 @@ int evaluate(const board_t *board, eval_t * eval) {
             }
         }
         if (on_white >= 1 && on_black >= 1) {
-            eval->middlegame -= bishop_pair_mg;
-            eval->endgame    -= bishop_pair_eg;
+            score += bishop_pair;
         }
     }
+    return score;
+}
 
-    // King safety in the middle game:
-    eval->middlegame += king_safety_score(board, WHITE, king_attacks_score[WHITE]);
-    eval->middlegame -= king_safety_score(board, BLACK, king_attacks_score[BLACK]);
-
-    // REVIEW: Seems not to be gaining any Elo in self-testing
-    // King pawn distance in the end game
-    //eval->endgame += KING_PAWN_DIST_BONUS * king_pawn_distance(board, WHITE);
-    //eval->endgame -= KING_PAWN_DIST_BONUS * king_pawn_distance(board, BLACK);
+/**
+ * @brief Evaluates the threats of a side once the attacks of both sides are
+ * known: safe pawns threatening enemy pieces & knight outposts
+ * @return score from the side's POV
+ */
+template<int COLOUR>
+score_t evaluate_threats(const board_t *board, const pawn_entry_t *pawn_entry,
+                         const bb_t sides_attacks[BOTH]) {
+    constexpr int THEM = COLOUR ^ 1;
+    const bb_t our_pawns = board->bitboards[PAWN_OF<COLOUR>];
+    const bb_t their_pawns = board->bitboards[PAWN_OF<THEM>];
+    score_t score = 0;
 
     // We give a relatively large bonus for safe pawns threatening to capture an enemy piece
-    bb_t safe_pawns[BOTH] = {sides_attacks[WHITE] & black_pawns, sides_attacks[BLACK] & white_pawns};
-    //-- White
-    eval->middlegame += SAFE_PAWN_ATTACK*CNT((ne_shift(safe_pawns[WHITE]) | nw_shift(safe_pawns[WHITE])) & (board->sides_pieces[BLACK] ^ black_pawns));
-    eval->endgame    += SAFE_PAWN_ATTACK*CNT((ne_shift(safe_pawns[WHITE]) | nw_shift(safe_pawns[WHITE])) & (board->sides_pieces[BLACK] ^ black_pawns));
-    //-- Black
-    eval->middlegame -= SAFE_PAWN_ATTACK*CNT((se_shift(safe_pawns[BLACK]) | sw_shift(safe_pawns[BLACK])) & (board->sides_pieces[WHITE] ^ white_pawns));
-    eval->endgame    -= SAFE_PAWN_ATTACK*CNT((se_shift(safe_pawns[BLACK]) | sw_shift(safe_pawns[BLACK])) & (board->sides_pieces[WHITE] ^ white_pawns));
+    // REVIEW: These are the pawns the opponent attacks (as the term has always
+    // been evaluated), rather than the pawns safe from its attacks
+    const bb_t safe_pawns = sides_attacks[THEM] & our_pawns;
+    score += SAFE_PAWN_ATTACK*CNT(pawn_attacks<COLOUR>(safe_pawns) &
+                                  (board->sides_pieces[THEM] ^ their_pawns));
 
     // Knight outposts:
     // - knight is protected by friendly pawn
     // - not attacked by enemy
-    //-- White
     /* REVIEW: Seem to be loosing Elo */
-    bb = board->bitboards[N] & ~sides_attacks[BLACK] & pawn_protected[WHITE];
+    bb_t bb = board->bitboards[set_colour(N, COLOUR)] & ~sides_attacks[THEM] &
+              pawn_entry->attacks[COLOUR];
     while (bb) {
-        sq = POPLSB(bb);
-        eval->middlegame += knight_outposts_mg[sq];
-        eval->endgame    += knight_outposts_eg[sq];
+        score += knight_outposts[relative_square<COLOUR>(POPLSB(bb))];
     }
-    //-- Black
-    bb = board->bitboards[n] & ~sides_attacks[WHITE] & pawn_protected[BLACK];
-    while (bb) {
-        sq = mirror(POPLSB(bb));
-        eval->middlegame -= knight_outposts_mg[sq];
-        eval->endgame    -= knight_outposts_eg[sq];
+    return score;
+}
+
+// Originally from sjeng 11.2 (adapted from Vice 1.1)
+int material_draw(const board_t *board) {
+    assert(check(board));
+
+    int qs = CNT(queens(board));
+    int rs = CNT(rooks(board));
+    int bs = CNT(bishops(board));
+    int ns = CNT(knights(board));
+
+    int white_rs = CNT(board->bitboards[R]);
+    int black_rs = CNT(board->bitboards[r]);
+
+    int white_bs = CNT(board->bitboards[B]);
+    int black_bs = CNT(board->bitboards[b]);
+
+    int white_ns = CNT(board->bitboards[N]);
+    int black_ns = CNT(board->bitboards[n]);
+
+    if (!rs && !qs) {
+	  if (!bs) {
+	      if (black_ns < 3 && white_ns < 3) {  return 1; }
+	  } else if (!ns) {
+	     if (abs(white_bs - black_bs) < 2) { return 1; }
+	  } else if ((white_ns < 3 && !white_bs) || (white_bs == 1 && !white_ns)) {
+	    if ((black_ns < 3 && !black_bs) || (black_bs == 1 && !black_ns)) { return 1; }
+	  }
+	} else if (!qs) {
+        if (white_rs == 1 && black_rs == 1) {
+            if ((white_ns + white_bs) < 2 && (black_ns + black_bs) < 2) { return 1; }
+        } else if (white_rs == 1 && !black_rs) {
+            if ((white_ns + white_bs == 0) && (((black_ns + black_bs) == 1) || ((black_ns + black_bs) == 2))) { return 1; }
+        } else if (black_rs == 1 && !white_rs) {
+            if ((black_ns + black_bs == 0) && (((white_ns + white_bs) == 1) || ((white_ns + white_bs) == 2))) { return 1; }
+        }
+    }
+    return 0;
+}
+
+
+// Evaluates the data depending on the material only into a material hash entry
+void evaluate_material(const board_t *board, material_entry_t *entry) {
+    entry->key = board->material_key;
+    entry->draw = !pawns(board) && material_draw(board);
+    entry->bishops[WHITE] = CNT(board->bitboards[B]) >= 2;
+    entry->bishops[BLACK] = CNT(board->bitboards[b]) >= 2;
+}
+
+// Evaluates the position from the side's POV (without the evaluation cache),
+// lazily if the (alpha, beta) window isn't the full one
+int evaluate_uncached(const board_t *board, eval_t * eval,
+                      int alpha = -oo, int beta = +oo) {
+    assert(check(board));
+
+    eval->lazy = false;
+
+    // The network replaces the hand-crafted evaluation altogether
+    if (nnue_active()) {
+        return nnue_evaluate(board);
+    }
+
+    /* Setup */
+    // Material values & PSQTs, accumulated incrementally in the board
+    eval->total = board->psqt;
+    eval->set_phase(board);
+    int score = 0;
+
+    // Bishop pairs & draws by insufficient material, cached in the material
+    // hash table
+    material_entry_t material_scratch;
+    material_entry_t *material_entry = eval->material_table
+                                     ? eval->material_table->entry(board->material_key)
+                                     : &material_scratch;
+    if (material_entry == &material_scratch || material_entry->key != board->material_key) {
+        evaluate_material(board, material_entry);
+    }
+    #ifdef DEBUG
+    material_entry_t fresh_material;
+    evaluate_material(board, &fresh_material);
+    assert(material_entry->draw == fresh_material.draw);
+    assert(material_entry->bishops[WHITE] == fresh_material.bishops[WHITE]);
+    assert(material_entry->bishops[BLACK] == fresh_material.bishops[BLACK]);
+    #endif
+    if (material_entry->draw) {
+        return 0;
+    }
+
+    // During evaluation we incrementally build up the attack maps for both sides
+    bb_t sides_attacks[BOTH] = {0ULL, 0ULL};
+
+    /* Pawn structure */
+
+    // Pawn structure, cached in the pawn hash table
+    pawn_entry_t scratch;
+    pawn_entry_t *pawn_entry = eval->pawn_table ? eval->pawn_table->entry(board->pawn_key)
+                                                : &scratch;
+    if (pawn_entry == &scratch || pawn_entry->key != board->pawn_key) {
+        evaluate_pawns(board, pawn_entry);
     }
+    #ifdef DEBUG
+    pawn_entry_t fresh;
+    evaluate_pawns(board, &fresh);
+    assert(pawn_entry->score == fresh.score);
+    assert(pawn_entry->passed[WHITE] == fresh.passed[WHITE]);
+    assert(pawn_entry->passed[BLACK] == fresh.passed[BLACK]);
+    #endif
+    eval->total += pawn_entry->score;
 
     // Tempo score (small bonus for the side to move)
-    eval->middlegame += board->turn ? tempo_bonus_mg : -tempo_bonus_mg;
-    eval->endgame    += board->turn ? tempo_bonus_eg : -tempo_bonus_eg;
+    eval->total += board->turn ? tempo_bonus : -tempo_bonus;
+
+    /* Lazy evaluation */
+    // The remaining terms (the most expensive ones) only rarely make up for
+    // a score this far outside of the window
+    if (lazy_eval_margin && (-oo < alpha || beta < +oo)) {
+        ++eval->lazy_probes;
+        score = eval->get_tapered_score();
+        score = board->turn ? score : -score;
+        if (score + lazy_eval_margin <= alpha || score - lazy_eval_margin >= beta) {
+            ++eval->lazy_exits;
+            eval->lazy = true;
+            return score;
+        }
+    }
+
+    /* Pieces */
+    int king_attacks_score[BOTH] = {0, 0};
+    eval->total += evaluate_pieces<WHITE>(board, pawn_entry, material_entry,
+                                          sides_attacks, &king_attacks_score[BLACK]);
+    eval->total -= evaluate_pieces<BLACK>(board, pawn_entry, material_entry,
+                                          sides_attacks, &king_attacks_score[WHITE]);
+
+    // King safety in the middle game:
+    eval->total += S(king_safety_score<WHITE>(board, pawn_entry, king_attacks_score[WHITE]), 0);
+    eval->total -= S(king_safety_score<BLACK>(board, pawn_entry, king_attacks_score[BLACK]), 0);
+
+    // REVIEW: Seems not to be gaining any Elo in self-testing
+    // King pawn distance in the end game
+    //eval->total += KING_PAWN_DIST_BONUS * king_pawn_distance(board, WHITE);
+    //eval->total -= KING_PAWN_DIST_BONUS * king_pawn_distance(board, BLACK);
+
+    /* Threats (these need the attacks of both sides) */
+    eval->total += evaluate_threats<WHITE>(board, pawn_entry, sides_attacks);
+    eval->total -= evaluate_threats<BLACK>(board, pawn_entry, sides_attacks);
 
     /* Tapered evaluation */
     score = eval->get_tapered_score();
@@ -802,6 +583,44 @@ int evaluate(const board_t *board, eval_t * eval) {
     return board->turn ? score : -score;
 }
 
+} // namespace
+
+
+// Evaluates the position from the side's POV, lazily given a window
+int evaluate(const board_t *board, eval_t *eval, int alpha, int beta) {
+    if (!eval->eval_cache) {
+        return evaluate_uncached(board, eval, alpha, beta);
+    }
+
+    ++eval->cache_probes;
+    eval_cache_entry_t *entry = eval->eval_cache->entry(board->key);
+    if (entry->key == board->key) {
+        ++eval->cache_hits;
+        assert(entry->score == evaluate_uncached(board, eval));
+        eval->lazy = false;
+        return entry->score;
+    }
+    const int score = evaluate_uncached(board, eval, alpha, beta);
+    // (only the full evaluations are cached)
+    if (!eval->lazy) {
+        entry->key = board->key;
+        entry->score = score;
+    }
+    return score;
+}
+
+int evaluate(const board_t *board, eval_t *eval) {
+    return evaluate(board, eval, -oo, +oo);
+}
+
+void set_lazy_margin(int margin) {
+    lazy_eval_margin = margin;
+}
+
+int lazy_margin() {
+    return lazy_eval_margin;
+}
+
 void mirror_test(board_t *board) {
     eval_t eval[1];
     print(board);
@@ -850,6 +669,12 @@ void mirror_test(board_t *board) {
     board->castle_rights = tmp_castle_rights;
     board->ep_square = tmp_ep;
     board->key = generate_pos_key(board);
+    board->pawn_key = generate_pawn_key(board);
+    board->material_key = generate_material_key(board);
+    generate_psqt(board, &board->psqt, &board->phase);
+    if (nnue_active()) {
+        nnue_refresh(board, &board->accumulator);
+    }
 
     assert(check(board));
 
@@ -19,21 +19,121 @@
 #ifndef EVAL_H_
 #define EVAL_H_
 
+#include <algorithm> // std::fill
+
 #include "types.h"
 #include "board.h"
 #include "see.h"
+#include "params.h"
+
+/**
+ @brief Hash table caching evaluation terms by a Zobrist key, private to
+ a search thread (no synchronization). An entry simply gets replaced by
+ the entry of another key mapping to it
+ @tparam entry_t type of the entries, storing the key they're valid for
+ @tparam SIZE number of entries (a power of 2)
+ */
+template<typename entry_t, int SIZE>
+struct hash_table_t {
+    static_assert((SIZE & (SIZE - 1)) == 0, "The size should be a power of 2");
+
+    entry_t entries[SIZE];
+
+    // Returns the entry a key maps to (which may hold another key)
+    inline entry_t *entry(uint64_t key) {
+        return &entries[key & (SIZE - 1)];
+    }
+    // Clears the table (e.g. once the evaluation parameters change)
+    inline void clear() {
+        std::fill(std::begin(entries), std::end(entries), entry_t{});
+    }
+};
+
+// Number of entries in a pawn hash table
+constexpr int PAWN_TABLE_SIZE = 1 << 14;
+// Number of entries in a material hash table (there are few distinct
+// material configurations in a search)
+constexpr int MATERIAL_TABLE_SIZE = 1 << 12;
+// Number of entries in an evaluation cache
+constexpr int EVAL_CACHE_SIZE = 1 << 15;
+
+/**
+ @brief An entry of the pawn hash table: the evaluation terms depending on
+ the pawns only (from white's POV), and for each king the pawns shielding it
+ on the square it was last seen on (the king moves more often than the pawns)
+ */
+typedef struct pawn_entry_t {
+    // Pawn key of the position
+    uint64_t key = 0ULL;
+    // Pawn structure (isolated, passed, doubled and connected pawns)
+    score_t score = 0;
+    // Passed pawns & the squares attacked by pawns, indexed by colour
+    bb_t passed[BOTH] = {};
+    bb_t attacks[BOTH] = {};
+    // Number of friendly pawns right in front of the king & one rank further,
+    // valid while the king is on king_sq
+    square_t king_sq[BOTH] = {NO_SQ, NO_SQ};
+    int shield[BOTH][2] = {};
+} pawn_entry_t;
+
+// The pawn structure rarely changes between the nodes of the search, so most
+// evaluations find their pawn terms in the pawn hash table
+using pawn_table_t = hash_table_t<pawn_entry_t, PAWN_TABLE_SIZE>;
+
+/**
+ @brief An entry of the material hash table: the evaluation data depending
+ on the number of pieces of each type only
+ */
+typedef struct material_entry_t {
+    // Material key of the position (never 0, the kings are always hashed in)
+    uint64_t key = 0ULL;
+    // Whether the position is a draw by insufficient material
+    bool draw = false;
+    // Whether each side has at least two bishops (the bishop pair bonus also
+    // requires them to be on squares of both colours)
+    bool bishops[BOTH] = {};
+} material_entry_t;
+
+// Material changes only on captures and promotions
+using material_table_t = hash_table_t<material_entry_t, MATERIAL_TABLE_SIZE>;
+
+// An entry of the evaluation cache: the final score of a position
+typedef struct eval_cache_entry_t {
+    // Zobrist key of the position
+    uint64_t key = 0ULL;
+    // Score from the POV of the side to move
+    int score = 0;
+} eval_cache_entry_t;
+
+// The quiescence search evaluates the same leaves over and over, across
+// the iterations and sibling subtrees
+using eval_cache_t = hash_table_t<eval_cache_entry_t, EVAL_CACHE_SIZE>;
 
 /**
  @brief This struct scores and stores all relevant data for the evaluation of
  given board position
  */
 typedef struct eval_t {
+    // Pawn & material hash tables of the evaluating thread (none if nullptr,
+    // the terms are then computed on every evaluation)
+    pawn_table_t *pawn_table = nullptr;
+    material_table_t *material_table = nullptr;
+    // Evaluation cache of the evaluating thread (none if nullptr)
+    eval_cache_t *eval_cache = nullptr;
+    // Evaluations probing the evaluation cache & those finding their position
+    uint64_t cache_probes = 0;
+    uint64_t cache_hits = 0;
+    // Lazy evaluations (given a window, see evaluate()) & those exiting
+    // early, before the attack maps, mobility & king safety are evaluated
+    uint64_t lazy_probes = 0;
+    uint64_t lazy_exits = 0;
+    // Whether the last evaluation exited early, its score is then only an
+    // estimate known to be outside of the window
+    bool lazy = false;
     // Game phase (0, 256)
     int phase = 0;
-    // Middlegame score
-    int middlegame = 0;
-    // Endgame score
-    int endgame = 0;
+    // Middlegame & endgame scores
+    score_t total = 0;
     // Tapered score
     int score = 0;
 
@@ -44,15 +144,13 @@ typedef struct eval_t {
     The closer to the endgame we are, the more heavily endgame psqts
     are weighted. We use min(max(0, 1.5x - 64), 256) to scale between game phases
 
+    The material is weighted by PHASE_WEIGHT, accumulated in board_t::phase
+
     @param board boards state to calculate the game phase for
     @param eval eval_t struct to store the game phase in
     */
     inline void set_phase(const board_t *board) {
-        phase = CNT(board->bitboards[p] | board->bitboards[P]) << 1;
-        phase += 6 * CNT(board->bitboards[k] | board->bitboards[K]);
-        phase += 12 * CNT(board->bitboards[b] | board->bitboards[B]);
-        phase += 18 * CNT(board->bitboards[r] | board->bitboards[R]);
-        phase += 40 * CNT(board->bitboards[q] | board->bitboards[Q]);
+        phase = board->phase;
         phase *= 3;
         phase -= 128;
         phase >>= 1;
@@ -60,13 +158,13 @@ typedef struct eval_t {
     }
 
     inline int get_tapered_score() {
-        return score = (middlegame * phase + endgame * (256 - phase)) / 256;
+        return score = (mg_value(total) * phase + eg_value(total) * (256 - phase)) / 256;
     }
 
     inline void print() {
         std::cout << "Phase: " << phase \
-                  << " Middlegame score: " << middlegame \
-                  << " Endgame score: " << endgame \
+                  << " Middlegame score: " << mg_value(total) \
+                  << " Endgame score: " << eg_value(total) \
                   << " Final score: " << score << std::endl;
     }
 } eval_t;
@@ -83,6 +181,24 @@ typedef struct eval_t {
  */
 int evaluate(const board_t *board, eval_t *eval);
 
+/**
+ @brief Lazy evaluation for when only the score's position relative to the
+ (alpha, beta) window matters (e.g. the stand-pat test of the quiescence
+ search). Once the material, PSQTs, pawn structure & tempo are scored, the
+ evaluation exits early if the score is outside of the window by more than
+ the lazy margin (setting eval->lazy), otherwise it's the full evaluation
+ */
+int evaluate(const board_t *board, eval_t *eval, int alpha, int beta);
+
+/**
+ @brief Sets the margin of the lazy evaluation
+ @param margin margin in centipawns, 0 disables the lazy evaluation
+ */
+void set_lazy_margin(int margin);
+
+// The current margin of the lazy evaluation
+int lazy_margin();
+
 
 /**
  * @brief Determines whether a capture is losing based on static
@@ -96,53 +212,21 @@ int losing_capture(const board_t *board, move_t m, int threshold);
 
 void mirror_test(board_t *board);
 
-//Material
-extern int value_mg[PIECE_NO];
-extern int value_eg[PIECE_NO];
-// PSQTs
-extern int pawn_table_mg[SQUARE_NO];
-extern int pawn_table_eg[SQUARE_NO];
-extern int knight_table_mg[SQUARE_NO];
-extern int knight_table_eg[SQUARE_NO];
-extern int bishop_table_mg[SQUARE_NO];
-extern int bishop_table_eg[SQUARE_NO];
-extern int rook_table_mg[SQUARE_NO];
-extern int rook_table_eg[SQUARE_NO];
-extern int queen_table_mg[SQUARE_NO];
-extern int queen_table_eg[SQUARE_NO];
-extern int king_table_mg[SQUARE_NO];
-extern int king_table_eg[SQUARE_NO];
-
-// Tempo score (a small bonus for the side to move)
-extern int tempo_bonus_mg;
-extern int tempo_bonus_eg;
-// Pass and isolated pawn
-extern int isolated_pawn;
-// Doubled pawn penalty
-extern int doubled_pawn;
-// Bonus for supported pawns
-extern int pawn_supported;
-extern int pawn_protected_bonus;
-// Indexed by rank, i.e. the closer to promoting, the higher the bonus
-extern int passed_pawn[RANK_NO];
-// Indexed by rank, bonus for good pawn structure
-extern int pawn_bonuses[RANK_NO];
-// Bonus for having two bishops on board
-extern int bishop_pair_mg;
-extern int bishop_pair_eg;
-// Bonuses for rooks/queens on open/semi-open files
-extern int rook_open_file;
-extern int rook_semiopen_file;
-extern int queen_open_file;
-extern int queen_semiopen_file;
-// Mobility weights
-extern int mobility_weights[PIECE_NO];
-// King safety parameters
-extern int PAWN_SHIELD1_BONUS;
-extern int PAWN_SHIELD2_BONUS;
-extern int PAWN_STORM_PENALTY;
-extern int KING_PAWN_DIST_BONUS;
-extern int SAFE_PAWN_ATTACK;
+// Default margin of the lazy evaluation (the terms it skips rarely add up to
+// more in the positions the quiescence search evaluates)
+constexpr int LAZY_MARGIN = 400;
+
+// Game phase weights of the pieces, see eval_t::set_phase()
+constexpr int PHASE_WEIGHT[PIECE_NO] = {0, 2, 0, 12, 18, 40, 6, 0,
+                                           0, 2, 0, 12, 18, 40, 6};
+
+// Material + PSQT scores of the pieces on the squares from White's POV, as
+// accumulated in board_t (the kings are scored by the king safety terms only)
+extern score_t psqt[PIECE_NO][SQUARE_NO];
+
+// Combines the piece values & the PSQTs into psqt (again, whenever any of
+// them changes)
+void init_psqt();
 
 
 #endif // EVAL_H_
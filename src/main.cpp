@@ -37,6 +37,8 @@
 #include "uci.h"
 #include "attack.h"
 #include "search.h"
+#include "threads.h"
+#include "eval.h"
 //#include "sgd.h"
 
 int main(int argc, char* argv[]) {
@@ -81,12 +83,14 @@ int main(int argc, char* argv[]) {
     // Initialization
     init_keys();
     init_eval_masks();
+    init_psqt();
     init_leap_attacks();
     init_bishop_occupancies();
     init_rook_occupancies();
     init_magics<BISHOP>();
     init_magics<ROOK>();
     init_reductions();
+    set_threads(1);
 
     //tune();
 
@@ -0,0 +1,544 @@
+/*
+ Lishex (codename 1F98A), a UCI chess engine built in C++
+ Copyright (C) 2023 Michal Kurek
+
+ Lishex is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Lishex is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* NNUE evaluation */
+#include "nnue.h"
+
+#include <cstring> // std::memcmp, std::memcpy
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <immintrin.h>
+
+#ifdef __linux__
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h>    // open
+#include <unistd.h>   // close, pread
+#endif
+
+#include "board.h"
+#include "movegen.h"
+
+bool nnue_enabled = false;
+
+namespace {
+
+/*
+ * Network file format (little-endian, as laid out in memory):
+ * - nnue_header_t (64 bytes)
+ * - nnue_weights_t
+ * The weights are used right from the mapped pages, hence the header is
+ * padded so that the rows of the feature transformer stay 64-byte aligned.
+ */
+typedef struct nnue_header_t {
+    char magic[8] = {'L', 'S', 'H', 'X', 'N', 'N', 'U', 'E'};
+    uint32_t version = 1;
+    uint32_t inputs = NNUE_INPUTS;
+    uint32_t hidden = NNUE_HIDDEN;
+    uint32_t qa = NNUE_QA;
+    uint32_t qb = NNUE_QB;
+    uint32_t scale = NNUE_SCALE;
+    uint32_t reserved[8] = {};
+} nnue_header_t;
+
+static_assert(sizeof(nnue_header_t) == 64);
+
+typedef struct alignas(64) nnue_weights_t {
+    // Feature transformer (a row of weights per input feature)
+    int16_t ft_weights[NNUE_INPUTS][NNUE_HIDDEN];
+    int16_t ft_biases[NNUE_HIDDEN];
+    // Output layer, for the side to move's & the opponent's accumulators
+    int8_t out_weights[BOTH][NNUE_HIDDEN];
+    int32_t out_bias;
+} nnue_weights_t;
+
+// The network scores are kept well clear of the mate scores
+constexpr int NNUE_MAX_EVAL = oo / 2;
+
+// The loaded network, either mapped from a file or allocated (random)
+const nnue_weights_t *net = nullptr;
+void *mapped = nullptr;
+size_t mapped_size = 0;
+std::unique_ptr<nnue_weights_t> allocated;
+
+// Whether the Use NNUE option is set
+bool use_network = false;
+
+NNUE_KERNEL kernel = NNUE_KERNEL::NO;
+
+void update_enabled() {
+    nnue_enabled = use_network && net;
+}
+
+// Index of the input feature of a piece on a square, from the perspective
+// of one side (the board is mirrored for Black)
+inline int feature(const int perspective, const piece_t pce, const square_t sq) {
+    const int relative = piece_color(pce) != perspective;
+    const square_t s = perspective == WHITE ? sq : mirror(sq);
+    return (relative * 6 + piece_type(pce) - 1) * SQUARE_NO + s;
+}
+
+inline int clip(const int16_t x) {
+    return MIN(MAX(0, static_cast<int>(x)), NNUE_QA);
+}
+
+/* Scalar kernels */
+
+// Adds the 'add' weights to the accumulator & subtracts the 'sub' weights
+// (either can be nullptr)
+void update_scalar(int16_t *acc, const int16_t *add, const int16_t *sub) {
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+        acc[i] += (add ? add[i] : 0) - (sub ? sub[i] : 0);
+    }
+}
+
+// Dot product of the clipped accumulators with the output weights
+int32_t output_scalar(const int16_t *us, const int16_t *them, const int8_t *weights) {
+    int32_t sum = 0;
+    for (int i = 0; i < NNUE_HIDDEN; ++i) {
+        sum += clip(us[i]) * weights[i];
+        sum += clip(them[i]) * weights[NNUE_HIDDEN + i];
+    }
+    return sum;
+}
+
+/* SSE kernels (SSSE3 for the 8-bit multiply-add) */
+
+__attribute__((target("ssse3")))
+void update_sse(int16_t *acc, const int16_t *add, const int16_t *sub) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 8) {
+        __m128i *a = reinterpret_cast<__m128i*>(acc + i);
+        __m128i v = _mm_load_si128(a);
+        if (add) v = _mm_add_epi16(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + i)));
+        if (sub) v = _mm_sub_epi16(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + i)));
+        _mm_store_si128(a, v);
+    }
+}
+
+__attribute__((target("ssse3")))
+int32_t output_sse(const int16_t *us, const int16_t *them, const int8_t *weights) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i qa = _mm_set1_epi16(NNUE_QA);
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = zero;
+    for (int side = 0; side < BOTH; ++side) {
+        const int16_t *acc = side ? them : us;
+        const int8_t *w = weights + side * NNUE_HIDDEN;
+        for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+            __m128i lo = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i));
+            __m128i hi = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i + 8));
+            lo = _mm_min_epi16(_mm_max_epi16(lo, zero), qa);
+            hi = _mm_min_epi16(_mm_max_epi16(hi, zero), qa);
+            // The clipped values fit an unsigned byte, and the sums of two
+            // products (at most 2 * 127 * 128) don't saturate
+            const __m128i x = _mm_packus_epi16(lo, hi);
+            const __m128i products = _mm_maddubs_epi16(
+                x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+        }
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+/* AVX2 kernels */
+
+__attribute__((target("avx2")))
+void update_avx2(int16_t *acc, const int16_t *add, const int16_t *sub) {
+    for (int i = 0; i < NNUE_HIDDEN; i += 16) {
+        __m256i *a = reinterpret_cast<__m256i*>(acc + i);
+        __m256i v = _mm256_load_si256(a);
+        if (add) v = _mm256_add_epi16(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(add + i)));
+        if (sub) v = _mm256_sub_epi16(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sub + i)));
+        _mm256_store_si256(a, v);
+    }
+}
+
+__attribute__((target("avx2")))
+int32_t output_avx2(const int16_t *us, const int16_t *them, const int8_t *weights) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i qa = _mm256_set1_epi16(NNUE_QA);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = zero;
+    for (int side = 0; side < BOTH; ++side) {
+        const int16_t *acc = side ? them : us;
+        const int8_t *w = weights + side * NNUE_HIDDEN;
+        for (int i = 0; i < NNUE_HIDDEN; i += 32) {
+            __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i));
+            __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i + 16));
+            lo = _mm256_min_epi16(_mm256_max_epi16(lo, zero), qa);
+            hi = _mm256_min_epi16(_mm256_max_epi16(hi, zero), qa);
+            // packus interleaves the 128-bit lanes of lo & hi, the
+            // permutation restores the order of the weights
+            const __m256i x = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+            const __m256i products = _mm256_maddubs_epi16(
+                x, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i)));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+        }
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+}
+
+/* Kernel dispatch */
+
+inline void update(int16_t *acc, const int16_t *add, const int16_t *sub) {
+    switch (kernel) {
+        case NNUE_KERNEL::AVX2: update_avx2(acc, add, sub); break;
+        case NNUE_KERNEL::SSE:  update_sse(acc, add, sub); break;
+        default:                update_scalar(acc, add, sub); break;
+    }
+}
+
+inline int32_t output(NNUE_KERNEL k, const int16_t *us, const int16_t *them, const int8_t *weights) {
+    switch (k) {
+        case NNUE_KERNEL::AVX2: return output_avx2(us, them, weights);
+        case NNUE_KERNEL::SSE:  return output_sse(us, them, weights);
+        default:                return output_scalar(us, them, weights);
+    }
+}
+
+NNUE_KERNEL best_kernel() {
+    for (NNUE_KERNEL k : {NNUE_KERNEL::AVX2, NNUE_KERNEL::SSE}) {
+        if (nnue_kernel_supported(k)) {
+            return k;
+        }
+    }
+    return NNUE_KERNEL::SCALAR;
+}
+
+// Evaluates the position with the given kernel
+int evaluate_with(const board_t *board, NNUE_KERNEL k) {
+    const nnue_accumulator_t &acc = board->accumulator;
+    const int64_t sum = output(k, acc.values[board->turn], acc.values[board->turn ^ 1],
+                               net->out_weights[0]) + static_cast<int64_t>(net->out_bias);
+    const int64_t score = sum * NNUE_SCALE / (NNUE_QA * NNUE_QB);
+    return static_cast<int>(MIN(MAX(-NNUE_MAX_EVAL, score), NNUE_MAX_EVAL));
+}
+
+// Releases the loaded network (if any)
+void unload() {
+    #ifdef __linux__
+    if (mapped) {
+        munmap(mapped, mapped_size);
+    }
+    #endif
+    mapped = nullptr;
+    mapped_size = 0;
+    allocated.reset();
+    net = nullptr;
+}
+
+} // namespace
+
+
+bool nnue_load(const std::string &path) {
+    nnue_header_t header, expected;
+    const size_t bytes = sizeof(header) + sizeof(nnue_weights_t);
+
+    #ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0
+              && static_cast<size_t>(st.st_size) == bytes
+              && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+              && std::memcmp(&header, &expected, sizeof(header)) == 0;
+
+    // The weights are paged in from the file once they're accessed (and
+    // shared with other processes using the same file)
+    void *mem = valid ? mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    unload();
+    mapped = mem;
+    mapped_size = bytes;
+    net = reinterpret_cast<const nnue_weights_t*>(static_cast<char*>(mem) + sizeof(header));
+    #else
+    // Without mmap, the weights are read into memory
+    std::ifstream file(path, std::ios::binary);
+    auto weights = std::make_unique<nnue_weights_t>();
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    file.read(reinterpret_cast<char*>(weights.get()), sizeof(nnue_weights_t));
+    if (!file.good() || file.peek() != EOF
+        || std::memcmp(&header, &expected, sizeof(header)) != 0) {
+        return false;
+    }
+
+    unload();
+    allocated = std::move(weights);
+    net = allocated.get();
+    #endif
+
+    update_enabled();
+    return true;
+}
+
+void nnue_load_random(uint64_t seed) {
+    auto weights = std::make_unique<nnue_weights_t>();
+    uint64_t rng = seed | 1;
+    // Uniformly distributed in [-range, range]
+    auto random = [&rng](int range) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17; // xorshift64
+        return static_cast<int>(rng % (2 * range + 1)) - range;
+    };
+
+    for (auto &row : weights->ft_weights) {
+        for (int16_t &w : row) w = random(32);
+    }
+    for (int16_t &b : weights->ft_biases) b = random(32);
+    for (auto &side : weights->out_weights) {
+        for (int8_t &w : side) w = random(64);
+    }
+    weights->out_bias = random(1024);
+
+    unload();
+    allocated = std::move(weights);
+    net = allocated.get();
+    update_enabled();
+}
+
+bool nnue_save(const std::string &path) {
+    if (!net) {
+        return false;
+    }
+    nnue_header_t header;
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(net), sizeof(nnue_weights_t));
+    return file.good();
+}
+
+uint32_t nnue_id() {
+    if (!net) {
+        return 0;
+    }
+    // FNV-1a hash of the weights
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(net);
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < sizeof(nnue_weights_t); ++i) {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+    // (0 stands for the classical evaluation)
+    return hash | 1;
+}
+
+bool nnue_loaded() {
+    return net;
+}
+
+bool nnue_use(bool use) {
+    const bool was_used = use_network;
+    use_network = use;
+    update_enabled();
+    return was_used;
+}
+
+void nnue_unload() {
+    unload();
+    update_enabled();
+}
+
+bool nnue_set_kernel(const std::string &name) {
+    if (name == "auto") {
+        kernel = best_kernel();
+        return true;
+    }
+    for (NNUE_KERNEL k : {NNUE_KERNEL::SCALAR, NNUE_KERNEL::SSE, NNUE_KERNEL::AVX2}) {
+        if (name == nnue_kernel_name(k) && nnue_kernel_supported(k)) {
+            kernel = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+NNUE_KERNEL nnue_kernel() {
+    if (kernel == NNUE_KERNEL::NO) {
+        kernel = best_kernel();
+    }
+    return kernel;
+}
+
+const char *nnue_kernel_name(NNUE_KERNEL k) {
+    switch (k) {
+        case NNUE_KERNEL::AVX2:   return "avx2";
+        case NNUE_KERNEL::SSE:    return "sse";
+        case NNUE_KERNEL::SCALAR: return "scalar";
+        default:                  return "none";
+    }
+}
+
+bool nnue_kernel_supported(NNUE_KERNEL k) {
+    __builtin_cpu_init();
+    switch (k) {
+        case NNUE_KERNEL::AVX2:   return __builtin_cpu_supports("avx2");
+        case NNUE_KERNEL::SSE:    return __builtin_cpu_supports("ssse3");
+        case NNUE_KERNEL::SCALAR: return true;
+        default:                  return false;
+    }
+}
+
+void nnue_add(nnue_accumulator_t *acc, piece_t pce, square_t sq) {
+    for (int side : {WHITE, BLACK}) {
+        update(acc->values[side], net->ft_weights[feature(side, pce, sq)], nullptr);
+    }
+}
+
+void nnue_remove(nnue_accumulator_t *acc, piece_t pce, square_t sq) {
+    for (int side : {WHITE, BLACK}) {
+        update(acc->values[side], nullptr, net->ft_weights[feature(side, pce, sq)]);
+    }
+}
+
+void nnue_move(nnue_accumulator_t *acc, piece_t pce, square_t from, square_t to) {
+    for (int side : {WHITE, BLACK}) {
+        update(acc->values[side], net->ft_weights[feature(side, pce, to)],
+                                  net->ft_weights[feature(side, pce, from)]);
+    }
+}
+
+void nnue_refresh(const board_t *board, nnue_accumulator_t *acc) {
+    if (!net) {
+        return;
+    }
+    nnue_kernel();
+    for (int side : {WHITE, BLACK}) {
+        std::memcpy(acc->values[side], net->ft_biases, sizeof(net->ft_biases));
+    }
+    for (piece_t pce : pieces) {
+        bb_t bb = board->bitboards[pce];
+        while (bb) {
+            nnue_add(acc, pce, POPLSB(bb));
+        }
+    }
+}
+
+int nnue_evaluate(const board_t *board) {
+    assert(net);
+    return evaluate_with(board, kernel);
+}
+
+#ifdef DEBUG
+void nnue_test(const std::string &path) {
+    constexpr int steps_no = 200'000;
+    const bool loaded = nnue_loaded();
+    bool round_trip = true;
+    if (!loaded) {
+        nnue_load_random(0x9e3779b97f4a7c15ULL);
+        if (!path.empty()) {
+            round_trip = nnue_save(path) && nnue_load(path);
+            std::cout << "Random network saved to & mapped from " << path << ": "
+                      << (round_trip ? "ok" : "failed") << std::endl;
+        }
+    }
+    const bool used = nnue_use(true);
+    const NNUE_KERNEL selected = nnue_kernel();
+
+    std::vector<NNUE_KERNEL> kernels;
+    for (NNUE_KERNEL k : {NNUE_KERNEL::SCALAR, NNUE_KERNEL::SSE, NNUE_KERNEL::AVX2}) {
+        if (nnue_kernel_supported(k)) kernels.push_back(k);
+    }
+
+    // Plays random moves, taking some of them back & passing now and then,
+    // with the accumulators updated by every kernel in turn
+    uint64_t accumulator_mismatches = 0, output_mismatches = 0;
+    board_t board[1];
+    uint64_t rng = 0x2545f4914f6cdd1dULL;
+    std::vector<move_t> played;
+    for (int i = 0; i < steps_no; ++i) {
+        kernel = kernels[i % kernels.size()];
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17; // xorshift64
+
+        // (the games stay shorter than the maximum ply of a search, they're
+        // taken back to keep the debug build's reference boards in sync)
+        if (i == 0) {
+            setup(board, start_FEN);
+        }
+        if (board->history_ply >= 100) {
+            for (; !played.empty(); played.pop_back()) {
+                undo_move(board, played.back());
+            }
+        }
+
+        if (!played.empty() && rng % 4 == 0) {
+            undo_move(board, played.back());
+            played.pop_back();
+        } else {
+            movelist_t moves;
+            generate_moves(board, &moves);
+            bool moved = false;
+            for (size_t j = 0; j < moves.size() && !moved; ++j) {
+                move_t move = moves[(rng + j) % moves.size()];
+                if ((moved = make_move(board, move))) {
+                    played.push_back(move);
+                }
+            }
+            // Checkmate or stalemate
+            if (!moved) {
+                for (; !played.empty(); played.pop_back()) {
+                    undo_move(board, played.back());
+                }
+            }
+        }
+
+        const bool null_move = rng % 16 == 1;
+        if (null_move) {
+            make_null(board);
+        }
+
+        nnue_accumulator_t fresh;
+        nnue_refresh(board, &fresh);
+        accumulator_mismatches += std::memcmp(&fresh, &board->accumulator, sizeof(fresh)) != 0;
+
+        const int reference = evaluate_with(board, NNUE_KERNEL::SCALAR);
+        for (NNUE_KERNEL k : kernels) {
+            output_mismatches += evaluate_with(board, k) != reference;
+        }
+
+        if (null_move) {
+            undo_null(board);
+        }
+    }
+
+    std::cout << "Kernels:";
+    for (NNUE_KERNEL k : kernels) std::cout << " " << nnue_kernel_name(k);
+    std::cout << std::endl << "Positions: " << steps_no
+              << " accumulator mismatches: " << accumulator_mismatches
+              << " output mismatches: " << output_mismatches << std::endl
+              << (round_trip && accumulator_mismatches + output_mismatches == 0
+                  ? "Passed" : "Failed")
+              << std::endl;
+
+    kernel = selected;
+    nnue_use(used);
+    if (!loaded) {
+        nnue_unload();
+    }
+}
+#endif // DEBUG
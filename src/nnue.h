@@ -0,0 +1,138 @@
+/*
+ Lishex (codename 1F98A), a UCI chess engine built in C++
+ Copyright (C) 2023 Michal Kurek
+
+ Lishex is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Lishex is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NNUE_H_
+#define NNUE_H_
+
+#include <string>
+
+#include "types.h"
+
+/*
+ * Efficiently updatable neural network evaluation
+ *
+ * The network is a 768 -> 2x128 -> 1 perceptron: every (piece, square) pair
+ * is an input feature, seen from the perspective of both sides. The hidden
+ * layer (the feature transformer) is kept up to date incrementally in the
+ * board's accumulators as pieces are added, removed & moved. The evaluation
+ * then only clips the accumulators of the side to move & of its opponent and
+ * takes their dot product with the output weights.
+ */
+
+// Input features: (colour relative to the perspective, piece type, square)
+constexpr int NNUE_INPUTS = 2 * 6 * SQUARE_NO;
+// Neurons of the feature transformer (per perspective)
+constexpr int NNUE_HIDDEN = 128;
+// The accumulators are clipped to [0, NNUE_QA] (so that they fit an int8)
+constexpr int NNUE_QA = 127;
+// Quantisation factor of the output weights
+constexpr int NNUE_QB = 64;
+// The output is scaled to centipawns by NNUE_SCALE / (NNUE_QA * NNUE_QB)
+constexpr int NNUE_SCALE = 400;
+
+// Accumulators of the feature transformer for both perspectives
+typedef struct alignas(64) nnue_accumulator_t {
+    int16_t values[BOTH][NNUE_HIDDEN] = {};
+} nnue_accumulator_t;
+
+// SIMD kernels of the network, see nnue_set_kernel()
+enum class NNUE_KERNEL : int { SCALAR, SSE, AVX2, NO };
+
+struct board_t;
+
+// Whether the network is in use (the Use NNUE option is set & a network
+// is loaded), the accumulators are only updated while it is
+extern bool nnue_enabled;
+
+inline bool nnue_active() { return nnue_enabled; }
+
+/**
+ @brief Memory maps a network file (see nnue.cpp for the format)
+ @param path path to the file
+ @return True if the network was loaded, False if the file isn't a valid
+ network (any previously loaded network is kept then)
+ */
+bool nnue_load(const std::string &path);
+
+/**
+ @brief Initializes a network with pseudo-random weights (for testing)
+ @param seed seed of the weights
+ */
+void nnue_load_random(uint64_t seed);
+
+/**
+ @brief Writes the loaded network to a file in the format read by nnue_load()
+ @return True on success
+ */
+bool nnue_save(const std::string &path);
+
+// Whether a network is loaded
+bool nnue_loaded();
+
+// Identifies the loaded network by a (non-zero) hash of its weights,
+// 0 if no network is loaded
+uint32_t nnue_id();
+
+// Releases the loaded network
+void nnue_unload();
+
+// Enables the network (only takes effect once a network is loaded),
+// returns whether it was enabled before
+bool nnue_use(bool use);
+
+/**
+ @brief Selects the kernels of the network
+ @param name "avx2", "sse", "scalar" or "auto" (the fastest supported one)
+ @return False if the name is unknown or the CPU doesn't support the kernel
+ */
+bool nnue_set_kernel(const std::string &name);
+
+// The currently selected kernel & its name
+NNUE_KERNEL nnue_kernel();
+const char *nnue_kernel_name(NNUE_KERNEL kernel);
+
+// Whether the CPU supports a kernel
+bool nnue_kernel_supported(NNUE_KERNEL kernel);
+
+/* Incremental updates of the accumulators (when a piece is added, removed
+ * or moved on the board) */
+void nnue_add(nnue_accumulator_t *acc, piece_t pce, square_t sq);
+void nnue_remove(nnue_accumulator_t *acc, piece_t pce, square_t sq);
+void nnue_move(nnue_accumulator_t *acc, piece_t pce, square_t from, square_t to);
+
+// Computes the accumulators of a position from scratch
+void nnue_refresh(const board_t *board, nnue_accumulator_t *acc);
+
+/**
+ @brief Evaluates the position from the side's POV with the network
+ (using the board's accumulators)
+ */
+int nnue_evaluate(const board_t *board);
+
+#ifdef DEBUG
+/**
+ @brief Tests the network (debug builds only, see tests/tt_test.sh): plays random games from the starting
+ position and verifies that the incrementally updated accumulators match the ones
+ computed from scratch, and that all supported kernels agree on the
+ evaluations. A random network is used (and round-tripped through 'path',
+ if given) unless a network is already loaded
+ */
+void nnue_test(const std::string &path);
+#endif // DEBUG
+
+#endif // NNUE_H_
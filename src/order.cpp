@@ -119,7 +119,8 @@ inline void sort(movelist_t *moves) {
 } // namespace
 
 
-void score_moves(const board_t *board, movelist_t *moves, move_t pv_move, move_t *killers) {
+void score_moves(const board_t *board, movelist_t *moves, move_t pv_move,
+                 move_t *killers, const history_t history) {
     /* Initialize move scorer */
     moves->used = 0;
     move_t killer1 = killers != nullptr ? killers[0] : NULLMV;
@@ -190,7 +191,7 @@ void score_moves(const board_t *board, movelist_t *moves, move_t pv_move, move_t
             move.score = KILLER2_BONUS;
         /* Otherwise, order according to the move history */
         } else {
-            move.score = MAX(0, 100'000 + board->history_h[board->turn][board->pieces[from]][to]);
+            move.score = MAX(0, 100'000 + history[board->turn][board->pieces[from]][to]);
         }
 
         /* TODO: Additional small bonuses
@@ -28,8 +28,10 @@
  @param moves the movelist to score
  @param pv_move principal variation move to order first, if any
  @param killers killer moves that caused a cutoff, if any
+ @param history history heuristic table of the searching thread
  */
-void score_moves(const board_t *board, movelist_t *moves, move_t pv_move, move_t *killers);
+void score_moves(const board_t *board, movelist_t *moves, move_t pv_move,
+                 move_t *killers, const history_t history);
 
 // Returns the next best move
 move_t next_best(movelist_t *moves, int ply);
@@ -0,0 +1,180 @@
+/*
+ Lishex (codename 1F98A), a UCI chess engine built in C++
+ Copyright (C) 2023 Michal Kurek
+
+ Lishex is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Lishex is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Evaluation parameters
+ * Generated by write_params() (see sgd.cpp), regenerate the file with the
+ * tuner rather than editing it by hand */
+#ifndef PARAMS_H_
+#define PARAMS_H_
+
+#include "types.h"
+
+// The parameters are only mutable in the tuning build (make tuning=yes),
+// elsewhere they're compile-time constants the evaluation is folded with
+#ifdef TUNING
+#define PARAM inline
+#else
+#define PARAM inline constexpr
+#endif
+
+/* Piece values */
+// PESTO's piece values (also used by the SEE & the search, hence not packed,
+// the king's value doesn't fit a packed score)
+PARAM int value_mg[PIECE_NO] = {
+      0,  82, 337, 365, 477, 1025, 50000,   0,
+      0,  82, 337, 365, 477, 1025, 50000
+};
+PARAM int value_eg[PIECE_NO] = {
+      0,  94, 281, 297, 512, 936, 50000,   0,
+      0,  94, 281, 297, 512, 936, 50000
+};
+
+/* Positional parameters */
+// Tempo score (a small bonus for the side to move)
+PARAM score_t tempo_bonus = S(6, 0);
+// Isolated pawn penalty
+PARAM score_t isolated_pawn = S(-8, -8);
+// Doubled pawn penalty
+PARAM score_t doubled_pawn = S(-12, -12);
+// Bonus for supported pawns
+PARAM score_t pawn_supported = S(3, 3);
+// Bonus for pieces supported by pawns
+PARAM score_t pawn_protected_bonus = S(2, 2);
+// Indexed by rank, i.e. the closer to promoting, the higher the bonus
+PARAM score_t passed_pawn[RANK_NO] = {
+    S(   0,   0), S(   5,   5), S(  10,  10), S(  20,  20), S(  35,  35), S(  60,  60), S( 100, 100), S( 200, 200)
+};
+// Indexed by rank, bonus for good pawn structure
+PARAM score_t pawn_bonuses[RANK_NO] = {
+    S(   0,   0), S(   0,   0), S(   0,   0), S(   5,   5), S(  22,  22), S(  42,  42), S(  50,  50), S(  65,  65)
+};
+// Bonus for having two bishops on board
+PARAM score_t bishop_pair = S(3, 53);
+// Bonuses for rooks/queens on open/semi-open files
+PARAM score_t rook_open_file = S(11, 11);
+PARAM score_t rook_semiopen_file = S(5, 5);
+PARAM score_t queen_open_file = S(8, 8);
+PARAM score_t queen_semiopen_file = S(2, 2);
+// Mobility weights depending on the piece type
+PARAM score_t mobility_weights[PIECE_NO] = {
+    S(   0,   0), S(   0,   0), S(   2,   2), S(   2,   2), S(   1,   1), S(   1,   1), S(   0,   0), S(   0,   0),
+    S(   0,   0), S(   0,   0), S(   2,   2), S(   2,   2), S(   1,   1), S(   1,   1), S(   0,   0)
+};
+
+/* King safety parameters (middle game only, hence not packed) */
+PARAM int PAWN_SHIELD1_BONUS = 5;
+PARAM int PAWN_SHIELD2_BONUS = 4;
+PARAM int PAWN_STORM_PENALTY = 6;
+// Stronger pieces have a larger weight when attacking the enemy king
+PARAM int KING_ATTACK_WEIGHT[PIECE_NO] = {
+      0,   0,   1,   1,   2,   4,   0,   0,
+      0,   0,   1,   1,   2,   4,   0
+};
+// 49 is the max size of the king zone (refer to get_king_zone())
+// We use the weighted number of attackers onto the king zone
+// as an index into this array as a predictor
+// of how dangerous the opponent's attack is
+PARAM int KING_SAFETY_TABLE[50] = {
+      0,   1,   2,   3,   5,   7,   9,  12,  15,  18,
+     22,  26,  30,  35,  40,  45,  51,  57,  63,  70,
+     77,  84,  92, 100, 108, 117, 126, 135, 145, 155,
+    165, 176, 187, 198, 210, 222, 234, 247, 260, 273,
+    287, 301, 315, 330, 345, 360, 376, 392, 408, 425
+};
+// The king's distance to passed pawns (only matters in the endgame)
+PARAM score_t KING_PAWN_DIST_BONUS = S(0, 9);
+PARAM score_t SAFE_PAWN_ATTACK = S(18, 18);
+// Knight outpost bonus
+PARAM score_t KNIGHT_OUTPOST = S(5, 2);
+
+/* Piece-square tables */
+// Flipped PESTO's PSQTs (middle game, endgame)
+// see: https://www.chessprogramming.org/PeSTO%27s_Evaluation_Function
+PARAM score_t pawn_psqt[SQUARE_NO] = {
+    S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0),
+    S( -35,   0), S(  -1,   0), S( -20,   0), S( -23,   0), S( -15,   0), S(  24,   0), S(  38,   0), S( -22,   0),
+    S( -26,  13), S(  -4,   8), S(  -4,   8), S( -10,  10), S(   3,  13), S(   3,   0), S(  33,   2), S( -12,  -7),
+    S( -27,   4), S(  -2,   7), S(  -5,  -6), S(  12,   1), S(  17,   0), S(   6,  -5), S(  10,  -1), S( -25,  -8),
+    S( -14,  13), S(  13,   9), S(   6,  -3), S(  21,  -7), S(  23,  -7), S(  12,  -8), S(  17,   3), S( -23,  -1),
+    S(  -6,  32), S(   7,  24), S(  26,  13), S(  31,   5), S(  65,  -2), S(  56,   4), S(  25,  17), S( -20,  17),
+    S(  98,  94), S( 134, 100), S(  61,  85), S(  95,  67), S(  68,  56), S( 126,  53), S(  34,  82), S( -11,  84),
+    S(   0, 178), S(   0, 173), S(   0, 158), S(   0, 134), S(   0, 147), S(   0, 132), S(   0, 165), S(   0, 187)
+};
+PARAM score_t knight_psqt[SQUARE_NO] = {
+    S(-105, -29), S( -21, -51), S( -58, -23), S( -33, -15), S( -17, -22), S( -28, -18), S( -19, -50), S( -23, -64),
+    S( -29, -42), S( -53, -20), S( -12, -10), S(  -3,  -5), S(  -1,  -2), S(  18, -20), S( -14, -23), S( -19, -44),
+    S( -23, -23), S(  -9,  -3), S(  12,  -1), S(  10,  15), S(  19,  10), S(  17,  -3), S(  25, -20), S( -16, -22),
+    S( -13, -18), S(   4,  -6), S(  16,  16), S(  13,  25), S(  28,  16), S(  19,  17), S(  21,   4), S(  -8, -18),
+    S(  -9, -17), S(  17,   3), S(  19,  22), S(  53,  22), S(  37,  22), S(  69,  11), S(  18,   8), S(  22, -18),
+    S( -47, -24), S(  60, -20), S(  37,  10), S(  65,   9), S(  84,  -1), S( 129,  -9), S(  73, -19), S(  44, -41),
+    S( -73, -25), S( -41,  -8), S(  72, -25), S(  36,  -2), S(  23,  -9), S(  62, -25), S(   7, -24), S( -17, -52),
+    S(-167, -58), S( -89, -38), S( -34, -13), S( -49, -28), S(  61, -31), S( -97, -27), S( -15, -63), S(-107, -99)
+};
+PARAM score_t bishop_psqt[SQUARE_NO] = {
+    S( -33, -23), S(  -3,  -9), S( -14, -23), S( -21,  -5), S( -13,  -9), S( -12, -16), S( -39,  -5), S( -21, -17),
+    S(   4, -14), S(  15, -18), S(  16,  -7), S(   0,  -1), S(   7,   4), S(  21,  -9), S(  33, -15), S(   1, -27),
+    S(   0, -12), S(  15,  -3), S(  15,   8), S(  15,  10), S(  14,  13), S(  27,   3), S(  18,  -7), S(  10, -15),
+    S(  -6,  -6), S(  13,   3), S(  13,  13), S(  26,  19), S(  34,   7), S(  12,  10), S(  10,  -3), S(   4,  -9),
+    S(  -4,  -3), S(   5,   9), S(  19,  12), S(  50,   9), S(  37,  14), S(  37,  10), S(   7,   3), S(  -2,   2),
+    S( -16,   2), S(  37,  -8), S(  43,   0), S(  40,  -1), S(  35,  -2), S(  50,   6), S(  37,   0), S(  -2,   4),
+    S( -26,  -8), S(  16,  -4), S( -18,   7), S( -13, -12), S(  30,  -3), S(  59, -13), S(  18,  -4), S( -47, -14),
+    S( -29, -14), S(   4, -21), S( -82, -11), S( -37,  -8), S( -25,  -7), S( -42,  -9), S(   7, -17), S(  -8, -24)
+};
+PARAM score_t rook_psqt[SQUARE_NO] = {
+    S( -19,  -9), S( -13,   2), S(   1,   3), S(  17,  -1), S(  16,  -5), S(   7, -13), S( -37,   4), S( -26, -20),
+    S( -44,  -6), S( -16,  -6), S( -20,   0), S(  -9,   2), S(  -1,  -9), S(  11,  -9), S(  -6, -11), S( -71,  -3),
+    S( -45,  -4), S( -25,   0), S( -16,  -5), S( -17,  -1), S(   3,  -7), S(   0, -12), S(  -5,  -8), S( -33, -16),
+    S( -36,   3), S( -26,   5), S( -12,   8), S(  -1,   4), S(   9,  -5), S(  -7,  -6), S(   6,  -8), S( -23, -11),
+    S( -24,   4), S( -11,   3), S(   7,  13), S(  26,   1), S(  24,   2), S(  35,   1), S(  -8,  -1), S( -20,   2),
+    S(  -5,   7), S(  19,   7), S(  26,   7), S(  36,   5), S(  17,   4), S(  45,  -3), S(  61,  -5), S(  16,  -3),
+    S(  27,  11), S(  32,  13), S(  58,  13), S(  62,  11), S(  80,  -3), S(  67,   3), S(  26,   8), S(  44,   3),
+    S(  32,  13), S(  42,  10), S(  32,  18), S(  51,  15), S(  63,  12), S(   9,  12), S(  31,   8), S(  43,   5)
+};
+PARAM score_t queen_psqt[SQUARE_NO] = {
+    S(  -1, -33), S( -18, -28), S(  -9, -22), S(  10, -43), S( -15,  -5), S( -25, -32), S( -31, -20), S( -50, -41),
+    S( -35, -22), S(  -8, -23), S(  11, -30), S(   2, -16), S(   8, -16), S(  15, -23), S(  -3, -36), S(   1, -32),
+    S( -14, -16), S(   2, -27), S( -11,  15), S(  -2,   6), S(  -5,   9), S(   2,  17), S(  14,  10), S(   5,   5),
+    S(  -9, -18), S( -26,  28), S(  -9,  19), S( -10,  47), S(  -2,  31), S(  -4,  34), S(   3,  39), S(  -3,  23),
+    S( -27,   3), S( -27,  22), S( -16,  24), S( -16,  45), S(  -1,  57), S(  17,  40), S(  -2,  57), S(   1,  36),
+    S( -13, -20), S( -17,   6), S(   7,   9), S(   8,  49), S(  29,  47), S(  56,  35), S(  47,  19), S(  57,   9),
+    S( -24, -17), S( -39,  20), S(  -5,  32), S(   1,  41), S( -16,  58), S(  57,  25), S(  28,  30), S(  54,   0),
+    S( -28,  -9), S(   0,  22), S(  29,  22), S(  12,  27), S(  59,  27), S(  44,  19), S(  43,  10), S(  45,  20)
+};
+PARAM score_t king_psqt[SQUARE_NO] = {
+    S( -15, -53), S(  36, -34), S(  12, -21), S( -54, -11), S(   8, -28), S( -28, -14), S(  24, -24), S(  14, -43),
+    S(   1, -27), S(   7, -11), S(  -8,   4), S( -64,  13), S( -43,  14), S( -16,   4), S(   9,  -5), S(   8, -17),
+    S( -14, -19), S( -14,  -3), S( -22,  11), S( -46,  21), S( -44,  23), S( -30,  16), S( -15,   7), S( -27,  -9),
+    S( -49, -18), S(  -1,  -4), S( -27,  21), S( -39,  24), S( -46,  27), S( -44,  23), S( -33,   9), S( -51, -11),
+    S( -17,  -8), S( -20,  22), S( -12,  24), S( -27,  27), S( -30,  26), S( -25,  33), S( -14,  26), S( -36,   3),
+    S(  -9,  10), S(  24,  17), S(   2,  23), S( -16,  15), S( -20,  20), S(   6,  45), S(  22,  44), S( -22,  13),
+    S(  29, -12), S(  -1,  17), S( -20,  14), S(  -7,  17), S(  -8,  17), S(  -4,  38), S( -38,  23), S( -29,  11),
+    S( -65, -74), S(  23, -35), S(  16, -18), S( -15, -18), S( -56, -11), S( -34,  15), S(   2,   4), S(  13, -17)
+};
+// Knight outposts (TOGA Log Manual inspired)
+PARAM score_t knight_outposts[SQUARE_NO] = {
+    S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0),
+    S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0),
+    S(   0,   0), S(   0,   0), S(   3,   2), S(   4,   3), S(   4,   3), S(   3,   2), S(   0,   0), S(   0,   0),
+    S(   0,   0), S(   2,   1), S(   4,   2), S(   8,   4), S(   8,   4), S(   4,   2), S(   2,   1), S(   0,   0),
+    S(   0,   0), S(   2,   1), S(   4,   2), S(   8,   4), S(   8,   4), S(   4,   2), S(   2,   1), S(   0,   0),
+    S(   0,   0), S(   0,   0), S(   0,   1), S(   0,   1), S(   0,   1), S(   0,   1), S(   0,   0), S(   0,   0),
+    S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0),
+    S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0), S(   0,   0)
+};
+
+#endif // PARAMS_H_
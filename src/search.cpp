@@ -28,11 +28,6 @@
 #include "order.h"
 #include "transposition.h"
 
-// Global evaluation struct (for multithreaded, we'll want to have a separate one for
-// each thread)
-eval_t eval;
-
-
 namespace {
 
 // For maintaining the principal variation in the triangular array
@@ -42,59 +37,26 @@ void movcpy(move_t *p_tgt, move_t *p_src, int n) {
     while (n-- && (*p_tgt++ = *p_src++));
 }
 
-/* Principal Variation
-
-Triangular table layout:
-
-ply  maxLengthPV
-    +--------------------------------------------+
-0   |N                                           |
-    +------------------------------------------+-+
-1   |N-1                                       |
-    +----------------------------------------+-+
-2   |N-2                                     |
-    +--------------------------------------+-+
-3   |N-3                                   |
-    +------------------------------------+-+
-4   |N-4                                 |
-...                        /
-N-4 |4      |
-    +-----+-+
-N-3 |3    |
-    +---+-+
-N-2 |2  |
-    +-+-+
-N-1 |1|
-    +-+
-*/
-
-typedef struct pv_line {
-    move_t moves[MAX_DEPTH] = {};
-    size_t size = 0;
-    void clear() { last = moves; size = 0; memset(moves, 0, sizeof(moves)); }
-
-    move_t operator[](int i) const { return moves[i]; }
-    move_t& operator[](int i)      { return moves[i]; }
-
-    // Print the principal variation line
-    void print() const {
-        for (size_t i = 0; i < size; ++i) {
-            std::cout << move_to_str(moves[i]) << " ";
-        }
-    }
-
-    private:
-        move_t *last = moves;
-} pv_line;
-
-// Global PV table (quadratic approach)
-// - indexed by [ply]
-// - pv[ply] is the principal variation line for the search at depth 'ply'
-pv_line pv_tb[MAX_DEPTH+1];
-
 // Reduction plies for LMR (Dumb engine inspired)
 int lmr_depth_reduction[MAX_DEPTH][MAX_MOVES];
 
+// Minimal interval (in ms) between the reports of the transposition
+// table's statistics, 0 if they're disabled
+int tt_stats_interval = 0;
+
+// Static evaluation of the position, reusing the one stored in the probed
+// transposition table entry if there's one. Given an (α, β) window, the
+// evaluation may be lazy (thread->eval.lazy is then set, see evaluate())
+inline int static_eval(board_t *board, thread_t *thread, const tt_entry *entry,
+                       int α = -oo, int β = +oo) {
+    if (entry->pos_key() == board->key && entry->eval() != NO_EVAL) {
+        assert(entry->eval() == evaluate(board, &thread->eval));
+        thread->eval.lazy = false;
+        return entry->eval();
+    }
+    return evaluate(board, &thread->eval, α, β);
+}
+
 
 // TODO: Use Unicode chars in source code? Compiler compatibility?
 // int α = alpha;
@@ -104,12 +66,14 @@ int lmr_depth_reduction[MAX_DEPTH][MAX_MOVES];
  @brief Alpha-Beta search in negamax fashion.
  @param alpha the lowerbound
  @param beta the upperbound
- @param board the board position to search
- @param info search info: time, depth to search, etc.
+ @param thread the searching thread (board position, search info, stack, etc.)
  @param do_null whether to perform a null move or not
- @param pv reference to a table storing the (depth - 1) principal variation
 */
-int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack_t *stack, bool do_null) {
+int negamax(int α, int β, int depth, thread_t *thread, bool do_null) {
+    board_t *board = thread->board;
+    searchinfo_t *info = thread->info;
+    stack_t *stack = thread->stack;
+
     assert(check(board));
     assert(α < β);
     assert(depth >= 0);
@@ -118,30 +82,30 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
     int pv_node = α + 1 < β;
 
     // PV for the current search ply
-    pv_line &pv = pv_tb[board->ply];
+    pv_line &pv = thread->pv_tb[board->ply];
     // PV for the next search ply
-    pv_line &next_pv = pv_tb[board->ply + 1];
+    pv_line &next_pv = thread->pv_tb[board->ply + 1];
 
     // Set principal variation line size for the current search ply
     pv.size = board->ply;
 
     /* Recursion base case */
     if (depth <= 0) {
-        return quiescence(α, β, board, info, stack);
+        return quiescence(α, β, thread);
     }
 
-    ++info->nodes;
+    info->count_node();
 
     // If not at root of the search, check for repetitions
     if (board->ply && (is_repetition(board) || board->fifty_move >= 100)) {
         //return 0;
         // Randomized draw score
-        return -2 + (info->nodes & 0x3);
+        return -2 + (info->nodes_no() & 0x3);
     }
 
     // Are we too deep into the search tree?
     if (board->ply >= MAX_DEPTH - 1) {
-        return evaluate(board, &eval);
+        return evaluate(board, &thread->eval);
     }
 
     // Mate distance pruning (https://www.chessprogramming.org/Mate_Distance_Pruning)
@@ -157,7 +121,7 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
 
     /* Transposition table probing */
     tt_entry entry[1];
-    int tthit = tt.probe(board, entry, ttmove, score, α, β, depth);
+    int tthit = tt.probe(board, entry, ttmove, score, α, β, depth, &thread->tt_stats);
 
     // Check if can get a cutoff
     if (!pv_node && tthit) {
@@ -170,7 +134,7 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
     }
 
     /* Get a static evaluation of the current position */
-    stack[board->ply].score = score = evaluate(board, &eval);
+    stack[board->ply].score = score = static_eval(board, thread, entry);
     // Is the side-to-move improving their position?
     const bool improving = board->ply >= 2 && score > stack[board->ply - 2].score;
 
@@ -218,7 +182,7 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
             make_null(board);
             // do_null is now set to false, since we don't want to do two null moves
             // in a row
-            score = -negamax(-β, -β + 1, depth - 1 - R, board, info, stack, false);
+            score = -negamax(-β, -β + 1, depth - 1 - R, thread, false);
             undo_null(board);
 
             if (search_stopped(info))
@@ -248,9 +212,9 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
         int razor = α - 100 * depth + 30;
         if (score <= razor) {
             if (depth <= 2) {
-                return quiescence(α, β, board, info, stack);
+                return quiescence(α, β, thread);
             }
-            else if (quiescence(razor, razor + 1, board, info, stack) <= razor) {
+            else if (quiescence(razor, razor + 1, thread) <= razor) {
                 return α;
             }
         }
@@ -269,7 +233,7 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
 
     // If following the principal variation (from a previous search at a smaller
     // depth), order the PV move higher
-    score_moves(board, &moves, ttmove, stack[board->ply].killer);
+    score_moves(board, &moves, ttmove, stack[board->ply].killer, thread->history_h);
 
     int moves_searched = 0;
     int quiet_moves_searched = 0;
@@ -294,6 +258,9 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
             break; // Fail-low and fail hard
         }
 
+        // Start fetching the child's bucket while the move is being made
+        tt.prefetch(key_after(board, move));
+
         // Pseudo-legal move generation
         if (!make_move(board, move))
             continue;
@@ -306,7 +273,7 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
         if (moves_searched == 0) {
             // We assume, given good move ordering, that the first move
             // is a PV move (leading to a PV node) so we perform a full search
-            score = -negamax(-β, -α, depth - 1, board, info, stack, USE_NULL);
+            score = -negamax(-β, -α, depth - 1, thread, USE_NULL);
         } else {
             /* [LMR] Late Move Reduction */
             // We check whether to consider a reduction or not. We do so if:
@@ -334,12 +301,11 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
                 R += !improving;
 
                 // Reduce more on bad moves according to the history
-                //R += (board->history_h[board->turn][board->pieces[get_from(move)]][get_to(move)] < 0);
+                //R += (thread->history_h[board->turn][board->pieces[get_from(move)]][get_to(move)] < 0);
 
                 // Clamp the reduction so we don't drop into negative depths
                 R = std::clamp(R, 0, depth - 1);
-                score = -negamax(-α - 1, -α, depth - 1 - R, board, info, stack,
-                                 USE_NULL);
+                score = -negamax(-α - 1, -α, depth - 1 - R, thread, USE_NULL);
             } else {
                 // Trick to ensure a full-depth search is done
                 // credit to Tord Romstad:
@@ -349,11 +315,11 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
 
             if (score > α) {
                 // [PVS] We first search the remaining moves with a zero window
-                score = -negamax(-α - 1, -α, depth - 1, board, info, stack, USE_NULL);
+                score = -negamax(-α - 1, -α, depth - 1, thread, USE_NULL);
                 if (score > α && score < β) {
                     // If the score we got was outside of our window,
                     // we perform a full window re-search
-                    score = -negamax(-β, -α, depth - 1, board, info, stack, USE_NULL);
+                    score = -negamax(-β, -α, depth - 1, thread, USE_NULL);
                 }
             }
         }
@@ -393,12 +359,12 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
 
                         // Move causes a cutoff, hence update the search history tables
                         // (History heuristic)
-                        board->history_h[board->turn][board->pieces[get_from(move)]][get_to(move)] += depth * depth;
+                        thread->history_h[board->turn][board->pieces[get_from(move)]][get_to(move)] += depth * depth;
 
                         // Penalize all the previous quiet moves that *didn't* cause a cut-off
                         for (scored_move_t* it = moves.begin(); *it != move; ++it) {
                             if (get_flags(move) != QUIET) continue; // REVIEW: Might be unnecessary
-                            board->history_h[board->turn][board->pieces[get_from(*it)]][get_to(*it)] -= depth * depth;
+                            thread->history_h[board->turn][board->pieces[get_from(*it)]][get_to(*it)] -= depth * depth;
                         }
                     }
 
@@ -448,11 +414,13 @@ int negamax(int α, int β, int depth, board_t *board, searchinfo_t *info, stack
         bestscore = α;
     } else if (type == LOWER) {
         bestscore = β;
-        tt.store(board, bestmove, bestscore, type, depth);
+        tt.store(board, bestmove, bestscore, type, depth, stack[board->ply].score,
+                 &thread->tt_stats);
         return β;
     }
 
-    tt.store(board, bestmove, bestscore, type, depth);
+    tt.store(board, bestmove, bestscore, type, depth, stack[board->ply].score,
+             &thread->tt_stats);
 
     assert(check(board));
 
@@ -482,58 +450,54 @@ inline void print_search_info(int s, int d, int sd, uint64_t n, uint64_t t,
 }
 
 
-void init_search(board_t *board, searchinfo_t *info, stack_t *s) {
+void init_search(thread_t *thread) {
 
     // Scale tables used for the history heuristic
     for (piece_t p = NO_PIECE; p < PIECE_NO; ++p) {
         for (square_t sq = A1; sq <= H8; ++sq) {
             for (int colour : {BLACK, WHITE}) {
-                board->history_h[colour][p][sq] /= 16;
+                thread->history_h[colour][p][sq] /= 16;
             }
         }
     }
 
-    // Clear the global pv table
+    // Clear the thread's pv table
     for (int i = 0; i < MAX_DEPTH; ++i) {
-        pv_tb[i].clear();
+        thread->pv_tb[i].clear();
     }
 
     // Clear search info, like # nodes searched
-    info->clear();
-
-    // Increment the transposition table's age
-    // tt.age();
+    thread->info->clear();
 
-    // Reset statistics for the transposition table
-    tt.reset_stats();
+    // Reset the thread's statistics for the transposition table
+    thread->tt_stats.clear();
 
     // Clear the search stack
     // - killers
     // - scores
-    for (int i = 0; i < MAX_DEPTH; ++i) {
-        s->killer[0] = s->killer[1] = NULLMV;
-        s->score = 0;
+    for (int i = 0; i <= MAX_DEPTH; ++i) {
+        thread->stack[i].killer[0] = thread->stack[i].killer[1] = NULLMV;
+        thread->stack[i].score = 0;
     }
 
     // The ply at the root of the search is 0
-    board->ply = 0;
+    thread->board->ply = 0;
 }
 
 /**
  @brief Given the score from a previous search, we try to estimate the bounds of the window
  for the next search. This should result in more beta-cutoffs. If we get a score
  outside of the window, then we need to perform a research with a wider window
- @param board the board position to search
- @param info search info: time, depth to search, etc.
- @param stack the search stack with search data like previous moves and static evaluation scores
+ @param thread the searching thread (board position, search info, stack, etc.)
  @param depth number of plies to search
  @param do_null whether to perform a null move or not
 */
-int aspiration_window_search(board_t *board, searchinfo_t *info, stack_t *stack, int depth, bool do_null) {
+int aspiration_window_search(thread_t *thread, int depth, bool do_null) {
+    searchinfo_t *info = thread->info;
 
     // Initialize the initial window
     int aw_delta = 35;
-    int score = stack[0].score;
+    int score = thread->stack[0].score;
 
     int α = -oo, β = +oo;
 
@@ -546,7 +510,7 @@ int aspiration_window_search(board_t *board, searchinfo_t *info, stack_t *stack,
     // We keep retrying the search with larger and larger windows
     // (window widening code inspired by the Alexandria engine)
     for (;;) {
-        score = negamax(α, β, depth, board, info, stack, do_null);
+        score = negamax(α, β, depth, thread, do_null);
 
         if (search_stopped(info)) break;
 
@@ -585,15 +549,17 @@ void init_reductions() {
  positions to get a reliable score from our static evaluation function
  @param alpha the lowerbound
  @param beta the upperbound
- @param board the board position to search
- @param info search info: time, depth to search, etc.
- @param stack the search stack
+ @param thread the searching thread (board position, search info, stack, etc.)
 */
-int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stack) {
+int quiescence(int α, int β, thread_t *thread) {
+    board_t *board = thread->board;
+    searchinfo_t *info = thread->info;
+    stack_t *stack = thread->stack;
+
     assert(check(board));
     assert(α < β);
 
-    ++info->nodes;
+    info->count_node();
 
     int pv_node = α + 1 < β;
 
@@ -611,7 +577,7 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
     int score = -oo;
     move_t ttmove = NULLMV;
     tt_entry entry[1];
-    int tthit = tt.probe(board, entry, ttmove, score, α, β, 0);
+    int tthit = tt.probe(board, entry, ttmove, score, α, β, 0, &thread->tt_stats);
 
     // Check if can get a cutoff (don't cutoff on PV nodes)
     if (!pv_node && tthit) {
@@ -620,7 +586,10 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
     }
 
     /* Stand-pat score */
-    stack[board->ply].score = score = evaluate(board, &eval);
+    // For the cutoff, only whether it clears the window matters, so it may
+    // be a lazy estimate (which must not get stored in the TT as the
+    // position's evaluation)
+    stack[board->ply].score = score = static_eval(board, thread, entry, α, β);
 
     assert(-oo < score && score < +oo);
 
@@ -633,6 +602,13 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
         return β;
     }
 
+    // An estimate below the window may be too low by up to the lazy margin,
+    // raising α & delta pruning need the full evaluation
+    if (thread->eval.lazy) {
+        stack[board->ply].score = score = evaluate(board, &thread->eval);
+    }
+    const int tt_eval = score;
+
     if (score > α) { // PV-node
         α = score;
     }
@@ -641,7 +617,7 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
     generate_noisy(board, &noisy);
 
     // Move ordering           // TT move, if any
-    score_moves(board, &noisy, ttmove, nullptr);
+    score_moves(board, &noisy, ttmove, nullptr, thread->history_h);
 
     #ifdef DEBUG
     int moves_searched = 0;
@@ -670,6 +646,9 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
 
         /* All pruning checks failed, hence the move is promising and we try making it */
 
+        // Start fetching the child's bucket while the move is being made
+        tt.prefetch(key_after(board, move));
+
         // Pseudo-legal move generation
         if (!make_move(board, move))
             continue;
@@ -677,7 +656,7 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
         #ifdef DEBUG
         ++moves_searched;
         #endif
-        score = -quiescence(-β, -α, board, info, stack);
+        score = -quiescence(-β, -α, thread);
 
         undo_move(board, move);
 
@@ -692,7 +671,7 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
             }
             info->fail_high++;
             #endif
-            tt.store(board, move, β, LOWER, 0); // qs tt entries are easily overrideable
+            tt.store(board, move, β, LOWER, 0, tt_eval, &thread->tt_stats); // qs tt entries are easily overrideable
             return β;
         }
 
@@ -702,23 +681,38 @@ int quiescence(int α, int β, board_t *board, searchinfo_t *info, stack_t *stac
         }
     }
 
-    tt.store(board, bestmove, α, UPPER, 0); // qs tt entries are easily overrideable
+    tt.store(board, bestmove, α, UPPER, 0, tt_eval, &thread->tt_stats); // qs tt entries are easily overrideable
     return α;
 }
 
-/* Search the tree starting from the root node (current board state) */
-void search(board_t *board, searchinfo_t *info) {
-    assert(check(board));
+namespace {
+
+// Copies the search limits set by the UCI loop over to a helper thread
+void copy_limits(searchinfo_t *tgt, const searchinfo_t *src) {
+    tgt->depth    = src->depth;
+    tgt->time     = src->time;
+    tgt->inc      = src->inc;
+    tgt->start    = src->start;
+    tgt->end      = src->end;
+    tgt->time_set = src->time_set;
+}
+
+} // namespace
+
+move_t iterative_deepening(thread_t *thread) {
+    board_t *board = thread->board;
+    searchinfo_t *info = thread->info;
+    stack_t *stack = thread->stack;
 
     move_t best_move = NULLMV;
     int best_score = 0;
-    stack_t stack[MAX_DEPTH+1] = {};
 
     // Clear for search
-    init_search(board, info, stack);
+    init_search(thread);
 
     int curr_depth_nodes = 0;
     int curr_depth_time = 0;
+    uint64_t last_tt_stats = now();
 
     /*
     std::cout << "Starting search: ";
@@ -728,16 +722,18 @@ void search(board_t *board, searchinfo_t *info) {
     */
 
     // Iterative deepening
-    for (int depth = 1; depth <= info->depth; ++depth) {
+    // (half of the helper threads skip the first depth, so that
+    // the threads' searches diverge from each other)
+    for (int depth = 1 + (thread->id & 1); depth <= info->depth; ++depth) {
         // For calculating the branching factor
-        curr_depth_nodes = info->nodes;
+        curr_depth_nodes = info->nodes_no();
 
         // For time management
         curr_depth_time = now();
 
-        stack[0].score = best_score = aspiration_window_search(board, info, stack, depth, USE_NULL);
+        stack[0].score = best_score = aspiration_window_search(thread, depth, USE_NULL);
 
-        curr_depth_nodes = info->nodes - curr_depth_nodes;
+        curr_depth_nodes = info->nodes_no() - curr_depth_nodes;
         curr_depth_time = now() - curr_depth_time;
 
         if (search_stopped(info)) {
@@ -746,14 +742,19 @@ void search(board_t *board, searchinfo_t *info) {
 
         assert(info->state == ENGINE_SEARCHING);
 
-        best_move = pv_tb[0][0];
+        best_move = thread->pv_tb[0][0];
+
+        // Helper threads only fill the transposition table
+        if (thread->id != 0) {
+            continue;
+        }
 
         print_search_info(best_score,
                           depth,
                           info->seldepth,
-                          info->nodes,
+                          nodes_searched(),
                           now() - info->start,
-                          pv_tb[0], board);
+                          thread->pv_tb[0], board);
 
         LOG("info string depth " << depth \
             << std::setprecision(4) \
@@ -766,6 +767,11 @@ void search(board_t *board, searchinfo_t *info) {
             << " seecut " << info->seecut \
         );
 
+        if (tt_stats_interval && now() - last_tt_stats >= static_cast<uint64_t>(tt_stats_interval)) {
+            tt.print_stats(std::cout, tt_stats_searched());
+            last_tt_stats = now();
+        }
+
         // We try to estimate if we have enough time to search the next depth,
         // and if not, we cut the search short to not waste the time
         // (REVIEW: This might be suboptimal since we could be filling the TT)
@@ -776,10 +782,46 @@ void search(board_t *board, searchinfo_t *info) {
         //}
     }
 
-    std::cout << "bestmove " << move_to_str(best_move) << std::endl;
+    assert(check(board));
+
+    return best_move;
+}
+
+void set_tt_stats_interval(int ms) {
+    tt_stats_interval = ms;
+}
 
+/* Search the tree starting from the root node (current board state) */
+void search(board_t *board, searchinfo_t *info) {
     assert(check(board));
 
+    // Increment the transposition table's age
+    tt.age();
+
+    // Every thread searches its own copy of the root position
+    // (the main thread's copy is set up by search_start())
+    thread_t *main_thread = threads[0].get();
+    main_thread->info = info;
+
+    // Wake up the helper threads (LazySMP)
+    for (size_t i = 1; i < threads.size(); ++i) {
+        thread_t *helper = threads[i].get();
+        *helper->board = *board;
+        copy_limits(helper->info, info);
+        helper->info->state = ENGINE_SEARCHING;
+        helper->start_searching();
+    }
+
+    move_t best_move = iterative_deepening(main_thread);
+
+    // Once the main thread is done, stop the helpers
+    for (size_t i = 1; i < threads.size(); ++i) {
+        threads[i]->info->state = ENGINE_STOPPED;
+        threads[i]->wait_for_search_finished();
+    }
+
+    std::cout << "bestmove " << move_to_str(best_move) << std::endl;
+
     // After the search is stopped, the thread sets the status to stopped
     info->state = ENGINE_STOPPED;
 }
@@ -19,6 +19,9 @@
 #ifndef SEARCH_H_
 #define SEARCH_H_
 
+#include <cstring>
+#include <iostream>
+
 #include "types.h"
 #include "board.h"
 #include "bitboard.h"
@@ -26,23 +29,86 @@
 #include "time.h"
 #include "transposition.h"
 
+// Per-thread search data, see threads.h
+struct thread_t;
+
+/* Principal Variation
+
+Triangular table layout:
+
+ply  maxLengthPV
+    +--------------------------------------------+
+0   |N                                           |
+    +------------------------------------------+-+
+1   |N-1                                       |
+    +----------------------------------------+-+
+2   |N-2                                     |
+    +--------------------------------------+-+
+3   |N-3                                   |
+    +------------------------------------+-+
+4   |N-4                                 |
+...                        /
+N-4 |4      |
+    +-----+-+
+N-3 |3    |
+    +---+-+
+N-2 |2  |
+    +-+-+
+N-1 |1|
+    +-+
+*/
+
+typedef struct pv_line {
+    move_t moves[MAX_DEPTH] = {};
+    size_t size = 0;
+    void clear() { last = moves; size = 0; memset(moves, 0, sizeof(moves)); }
+
+    move_t operator[](int i) const { return moves[i]; }
+    move_t& operator[](int i)      { return moves[i]; }
+
+    // Print the principal variation line
+    void print() const {
+        for (size_t i = 0; i < size; ++i) {
+            std::cout << move_to_str(moves[i]) << " ";
+        }
+    }
+
+    private:
+        move_t *last = moves;
+} pv_line;
 
 /**
  @brief Quiescence search
  @param alpha the lowerbound
  @param beta the upperbound
- @param board the board position to search
- @param info search info: time, depth to search, etc.
+ @param thread the searching thread (board position, search info, stack, etc.)
+*/
+int quiescence(int alpha, int beta, thread_t *thread);
+
+/**
+ @brief Iterative deepening loop run by every thread in the pool. Only the
+ main thread reports search info lines to the GUI
+ @param thread the searching thread
+ @returns the best move found at the last fully searched depth
 */
-int quiescence(int alpha, int beta, board_t *board, searchinfo_t *info, stack_t *stack);
+move_t iterative_deepening(thread_t *thread);
 
 /**
- @brief Searches the current board state for the best move
+ @brief Searches the current board state for the best move. The position
+ is searched by all threads in the pool (LazySMP), the main thread reports
+ the best move
  @param board the board state to search
  @param info search info: time, depth to search, etc.
 */
 void search(board_t *board, searchinfo_t *info);
 
+/**
+ @brief Sets how often the main thread reports the transposition table's
+ statistics (as info strings, after completing a depth) during a search
+ @param ms minimal interval between the reports in ms, 0 disables them
+*/
+void set_tt_stats_interval(int ms);
+
 /**
  @brief Initializes the values used for various reductions,
  like the Late Move Reduction
@@ -26,10 +26,15 @@
 #include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <cstdio>
 
 #include "board.h"
 #include "search.h"
 #include "eval.h"
+#include "threads.h"
+
+// The tuner needs mutable parameters, i.e. the tuning build (make tuning=yes)
+#ifdef TUNING
 
 namespace {
 
@@ -81,13 +86,13 @@ std::vector<param_t> best_parameters;
 // Vector storing gradients
 std::vector<double> gradients;
 
+// Search thread used for evaluating the datapoints
+thread_t tuner[1];
+
 // Error squared for a single datapoint x
 double error(datapoint_t& x) {
-    board_t b[1];
-    searchinfo_t i[1];
-    stack_t s[MAX_MOVES];
-    setup(b, x.fen);
-    int score = quiescence(-oo, +oo, b, i, s);
+    setup(tuner->board, x.fen);
+    int score = quiescence(-oo, +oo, tuner);
     return std::pow(x.result - winning_prob(score), 2);
 }
 
@@ -96,6 +101,14 @@ double MSE(int batch = -1) {
     if (batch == -1)
         batch = positions.size();
 
+    // The material + PSQT scores are combined anew, and the entries (and the
+    // static evaluations they store) are stale once the parameters change, as
+    // are the cached pawn terms
+    init_psqt();
+    tt.clear();
+    tuner->pawn_table.clear();
+    tuner->eval_cache.clear();
+
     double total_error = 0;
     for (int i = 0; i < batch; ++i) {
         total_error += error(positions[i]);
@@ -104,6 +117,8 @@ double MSE(int batch = -1) {
 }
 
 std::string dataset = "/home/mkjm/Projects/lishex/tune/dataset.csv";
+// The tuned parameters are written here, in the format of params.h
+std::string params_path = "params.h";
 
 void load_datapoints(std::string &filename) {
 
@@ -162,48 +177,48 @@ void register_parameters() {
     if constexpr (tune_pawn_psqt) {
         std::cout << "Tuning pawn piece-square tables" << std::endl;
         for (int i = 0; i < SQUARE_NO; ++i) {
-            parameters.push_back({"pawn_table_mg["+std::to_string(i)+"]", &pawn_table_mg[i]});
-            parameters.push_back({"pawn_table_eg["+std::to_string(i)+"]", &pawn_table_eg[i]});
+            parameters.push_back({"pawn_psqt_mg["+std::to_string(i)+"]", nullptr, &pawn_psqt[i], PART::MG});
+            parameters.push_back({"pawn_psqt_eg["+std::to_string(i)+"]", nullptr, &pawn_psqt[i], PART::EG});
         }
     }
 
     if constexpr (tune_knight_psqt) {
         std::cout << "Tuning knight piece-square tables" << std::endl;
         for (int i = 0; i < SQUARE_NO; ++i) {
-            parameters.push_back({"knight_table_mg["+std::to_string(i)+"]", &knight_table_mg[i]});
-            parameters.push_back({"knight_table_eg["+std::to_string(i)+"]", &knight_table_eg[i]});
+            parameters.push_back({"knight_psqt_mg["+std::to_string(i)+"]", nullptr, &knight_psqt[i], PART::MG});
+            parameters.push_back({"knight_psqt_eg["+std::to_string(i)+"]", nullptr, &knight_psqt[i], PART::EG});
         }
     }
 
     if constexpr (tune_bishop_psqt) {
         std::cout << "Tuning bishop piece-square tables" << std::endl;
         for (int i = 0; i < SQUARE_NO; ++i) {
-            parameters.push_back({"bishop_table_mg["+std::to_string(i)+"]", &bishop_table_mg[i]});
-            parameters.push_back({"bishop_table_eg["+std::to_string(i)+"]", &bishop_table_eg[i]});
+            parameters.push_back({"bishop_psqt_mg["+std::to_string(i)+"]", nullptr, &bishop_psqt[i], PART::MG});
+            parameters.push_back({"bishop_psqt_eg["+std::to_string(i)+"]", nullptr, &bishop_psqt[i], PART::EG});
         }
     }
 
     if constexpr (tune_rook_psqt) {
         std::cout << "Tuning rook piece-square tables" << std::endl;
         for (int i = 0; i < SQUARE_NO; ++i) {
-            parameters.push_back({"rook_table_mg["+std::to_string(i)+"]", &rook_table_mg[i]});
-            parameters.push_back({"rook_table_eg["+std::to_string(i)+"]", &rook_table_eg[i]});
+            parameters.push_back({"rook_psqt_mg["+std::to_string(i)+"]", nullptr, &rook_psqt[i], PART::MG});
+            parameters.push_back({"rook_psqt_eg["+std::to_string(i)+"]", nullptr, &rook_psqt[i], PART::EG});
         }
     }
 
     if constexpr (tune_queen_psqt) {
         std::cout << "Tuning queen piece-square tables" << std::endl;
         for (int i = 0; i < SQUARE_NO; ++i) {
-            parameters.push_back({"queen_table_mg["+std::to_string(i)+"]", &queen_table_mg[i]});
-            parameters.push_back({"queen_table_eg["+std::to_string(i)+"]", &queen_table_eg[i]});
+            parameters.push_back({"queen_psqt_mg["+std::to_string(i)+"]", nullptr, &queen_psqt[i], PART::MG});
+            parameters.push_back({"queen_psqt_eg["+std::to_string(i)+"]", nullptr, &queen_psqt[i], PART::EG});
         }
     }
 
     if constexpr (tune_king_psqt) {
         std::cout << "Tuning king piece-square tables" << std::endl;
         for (int i = 0; i < SQUARE_NO; ++i) {
-            parameters.push_back({"king_table_mg["+std::to_string(i)+"]", &king_table_mg[i]});
-            parameters.push_back({"king_table_eg["+std::to_string(i)+"]", &king_table_eg[i]});
+            parameters.push_back({"king_psqt_mg["+std::to_string(i)+"]", nullptr, &king_psqt[i], PART::MG});
+            parameters.push_back({"king_psqt_eg["+std::to_string(i)+"]", nullptr, &king_psqt[i], PART::EG});
         }
     }
 
@@ -216,24 +231,24 @@ void register_parameters() {
 
     if constexpr (tune_pawn_eval) {
         std::cout << "Tuning miscellaneous pawn evaluation parameters" << std::endl;
-        parameters.push_back({"isolated_pawn", &isolated_pawn});
-        parameters.push_back({"doubled_pawn", &doubled_pawn});
-        parameters.push_back({"pawn_supported", &pawn_supported});
-        parameters.push_back({"pawn_protected_bonus", &pawn_protected_bonus});
-        parameters.push_back({"SAFE_PAWN_ATTACK", &SAFE_PAWN_ATTACK});
+        parameters.push_back({"isolated_pawn", nullptr, &isolated_pawn});
+        parameters.push_back({"doubled_pawn", nullptr, &doubled_pawn});
+        parameters.push_back({"pawn_supported", nullptr, &pawn_supported});
+        parameters.push_back({"pawn_protected_bonus", nullptr, &pawn_protected_bonus});
+        parameters.push_back({"SAFE_PAWN_ATTACK", nullptr, &SAFE_PAWN_ATTACK});
         // Note: no pawns on rank 1 and 8 (rank indices 0 and 7)
-        parameters.push_back({"passed_pawn[1]", &passed_pawn[1]});
-        parameters.push_back({"passed_pawn[2]", &passed_pawn[2]});
-        parameters.push_back({"passed_pawn[3]", &passed_pawn[3]});
-        parameters.push_back({"passed_pawn[4]", &passed_pawn[4]});
-        parameters.push_back({"passed_pawn[5]", &passed_pawn[5]});
-        parameters.push_back({"passed_pawn[6]", &passed_pawn[6]});
-        parameters.push_back({"pawn_bonuses[1]", &pawn_bonuses[1]});
-        parameters.push_back({"pawn_bonuses[2]", &pawn_bonuses[2]});
-        parameters.push_back({"pawn_bonuses[3]", &pawn_bonuses[3]});
-        parameters.push_back({"pawn_bonuses[4]", &pawn_bonuses[4]});
-        parameters.push_back({"pawn_bonuses[5]", &pawn_bonuses[5]});
-        parameters.push_back({"pawn_bonuses[6]", &pawn_bonuses[6]});
+        parameters.push_back({"passed_pawn[1]", nullptr, &passed_pawn[1]});
+        parameters.push_back({"passed_pawn[2]", nullptr, &passed_pawn[2]});
+        parameters.push_back({"passed_pawn[3]", nullptr, &passed_pawn[3]});
+        parameters.push_back({"passed_pawn[4]", nullptr, &passed_pawn[4]});
+        parameters.push_back({"passed_pawn[5]", nullptr, &passed_pawn[5]});
+        parameters.push_back({"passed_pawn[6]", nullptr, &passed_pawn[6]});
+        parameters.push_back({"pawn_bonuses[1]", nullptr, &pawn_bonuses[1]});
+        parameters.push_back({"pawn_bonuses[2]", nullptr, &pawn_bonuses[2]});
+        parameters.push_back({"pawn_bonuses[3]", nullptr, &pawn_bonuses[3]});
+        parameters.push_back({"pawn_bonuses[4]", nullptr, &pawn_bonuses[4]});
+        parameters.push_back({"pawn_bonuses[5]", nullptr, &pawn_bonuses[5]});
+        parameters.push_back({"pawn_bonuses[6]", nullptr, &pawn_bonuses[6]});
     }
 
 }
@@ -242,7 +257,7 @@ void register_parameters() {
 void print_parameters(std::vector<param_t>& params) {
     std::cout << "Engine parameters:" << std::endl;
     for (const param_t &p : params) {
-        std::cout << p.name << " = " << *p.value << std::endl;
+        std::cout << p.name << " = " << p.get() << std::endl;
     }
 }
 
@@ -251,11 +266,12 @@ void print_parameters(std::vector<param_t>& params) {
 void estimate_gradient(const double old_L, const int batch, const int delta = 1) {
     for (size_t i = 0; i < parameters.size(); ++i) {
         // Vary the parameter value by delta
-        *parameters[i].value += delta;
+        const int value = parameters[i].get();
+        parameters[i].set(value + delta);
         // Estimate the gradient
         gradients[i] = MSE(batch) - old_L;
         // Restore the parameter's value
-        *parameters[i].value -= delta;
+        parameters[i].set(value);
     }
 }
 
@@ -289,11 +305,11 @@ void adam() {
             eta = alpha * std::sqrt(1.0 - std::pow(b2, epoch)) / (1.0 - std::pow(b1, epoch));
             delta = eta * M[i] / (std::sqrt(V[i]) + epsilon); // avoid div-by-zero
 
-            tmp = *param.value;
-            *param.value -= delta;
+            tmp = param.get();
+            param.set(static_cast<int>(tmp - delta));
 
-            if (*param.value != tmp) {
-              std::cout << param.name << ": " << tmp << " -> " << *param.value
+            if (param.get() != tmp) {
+              std::cout << param.name << ": " << tmp << " -> " << param.get()
                         << std::endl;
             }
         }
@@ -324,10 +340,144 @@ void adam() {
 }
 
 
+// A value of a parameter as it's written to params.h
+std::string to_string(int value, bool packed, bool padded) {
+    char buf[32];
+    if (packed) {
+        std::snprintf(buf, sizeof(buf), padded ? "S(%4d,%4d)" : "S(%d, %d)",
+                      mg_value(value), eg_value(value));
+    } else {
+        std::snprintf(buf, sizeof(buf), padded ? "%3d" : "%d", value);
+    }
+    return buf;
+}
+
+// Writes a single parameter, preceded by its (possibly multi-line) comment
+void write_param(std::ostream &out, const char *comment, const char *name,
+                 int value, bool packed) {
+    if (comment) out << comment << '\n';
+    out << "PARAM " << (packed ? "score_t " : "int ") << name << " = "
+        << to_string(value, packed, false) << ";\n";
+}
+
+// Writes an array of parameters, 'per_row' values per row
+void write_param(std::ostream &out, const char *comment, const char *name,
+                 const char *size, const int *values, int count, bool packed,
+                 int per_row) {
+    if (comment) out << comment << '\n';
+    out << "PARAM " << (packed ? "score_t " : "int ") << name << '[' << size << "] = {";
+    for (int i = 0; i < count; ++i) {
+        out << (i % per_row ? " " : "\n    ") << to_string(values[i], packed, true)
+            << (i + 1 < count ? "," : "");
+    }
+    out << "\n};\n";
+}
+
 } // namespace
 
+bool write_params(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << R"(/*
+ Lishex (codename 1F98A), a UCI chess engine built in C++
+ Copyright (C) 2023 Michal Kurek
+
+ Lishex is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ Lishex is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Evaluation parameters
+ * Generated by write_params() (see sgd.cpp), regenerate the file with the
+ * tuner rather than editing it by hand */
+#ifndef PARAMS_H_
+#define PARAMS_H_
+
+#include "types.h"
+
+// The parameters are only mutable in the tuning build (make tuning=yes),
+// elsewhere they're compile-time constants the evaluation is folded with
+#ifdef TUNING
+#define PARAM inline
+#else
+#define PARAM inline constexpr
+#endif
+
+/* Piece values */
+)";
+    write_param(out, "// PESTO's piece values (also used by the SEE & the search, hence not packed,\n"
+                     "// the king's value doesn't fit a packed score)",
+                "value_mg", "PIECE_NO", value_mg, PIECE_NO, false, 8);
+    write_param(out, nullptr, "value_eg", "PIECE_NO", value_eg, PIECE_NO, false, 8);
+
+    out << "\n/* Positional parameters */\n";
+    write_param(out, "// Tempo score (a small bonus for the side to move)",
+                "tempo_bonus", tempo_bonus, true);
+    write_param(out, "// Isolated pawn penalty", "isolated_pawn", isolated_pawn, true);
+    write_param(out, "// Doubled pawn penalty", "doubled_pawn", doubled_pawn, true);
+    write_param(out, "// Bonus for supported pawns", "pawn_supported", pawn_supported, true);
+    write_param(out, "// Bonus for pieces supported by pawns",
+                "pawn_protected_bonus", pawn_protected_bonus, true);
+    write_param(out, "// Indexed by rank, i.e. the closer to promoting, the higher the bonus",
+                "passed_pawn", "RANK_NO", passed_pawn, RANK_NO, true, 8);
+    write_param(out, "// Indexed by rank, bonus for good pawn structure",
+                "pawn_bonuses", "RANK_NO", pawn_bonuses, RANK_NO, true, 8);
+    write_param(out, "// Bonus for having two bishops on board", "bishop_pair", bishop_pair, true);
+    write_param(out, "// Bonuses for rooks/queens on open/semi-open files",
+                "rook_open_file", rook_open_file, true);
+    write_param(out, nullptr, "rook_semiopen_file", rook_semiopen_file, true);
+    write_param(out, nullptr, "queen_open_file", queen_open_file, true);
+    write_param(out, nullptr, "queen_semiopen_file", queen_semiopen_file, true);
+    write_param(out, "// Mobility weights depending on the piece type",
+                "mobility_weights", "PIECE_NO", mobility_weights, PIECE_NO, true, 8);
+
+    out << "\n/* King safety parameters (middle game only, hence not packed) */\n";
+    write_param(out, nullptr, "PAWN_SHIELD1_BONUS", PAWN_SHIELD1_BONUS, false);
+    write_param(out, nullptr, "PAWN_SHIELD2_BONUS", PAWN_SHIELD2_BONUS, false);
+    write_param(out, nullptr, "PAWN_STORM_PENALTY", PAWN_STORM_PENALTY, false);
+    write_param(out, "// Stronger pieces have a larger weight when attacking the enemy king",
+                "KING_ATTACK_WEIGHT", "PIECE_NO", KING_ATTACK_WEIGHT, PIECE_NO, false, 8);
+    write_param(out, "// 49 is the max size of the king zone (refer to get_king_zone())\n"
+                     "// We use the weighted number of attackers onto the king zone\n"
+                     "// as an index into this array as a predictor\n"
+                     "// of how dangerous the opponent's attack is",
+                "KING_SAFETY_TABLE", "50", KING_SAFETY_TABLE, 50, false, 10);
+    write_param(out, "// The king's distance to passed pawns (only matters in the endgame)",
+                "KING_PAWN_DIST_BONUS", KING_PAWN_DIST_BONUS, true);
+    write_param(out, nullptr, "SAFE_PAWN_ATTACK", SAFE_PAWN_ATTACK, true);
+    write_param(out, "// Knight outpost bonus", "KNIGHT_OUTPOST", KNIGHT_OUTPOST, true);
+
+    out << "\n/* Piece-square tables */\n";
+    write_param(out, "// Flipped PESTO's PSQTs (middle game, endgame)\n"
+                     "// see: https://www.chessprogramming.org/PeSTO%27s_Evaluation_Function",
+                "pawn_psqt", "SQUARE_NO", pawn_psqt, SQUARE_NO, true, 8);
+    write_param(out, nullptr, "knight_psqt", "SQUARE_NO", knight_psqt, SQUARE_NO, true, 8);
+    write_param(out, nullptr, "bishop_psqt", "SQUARE_NO", bishop_psqt, SQUARE_NO, true, 8);
+    write_param(out, nullptr, "rook_psqt", "SQUARE_NO", rook_psqt, SQUARE_NO, true, 8);
+    write_param(out, nullptr, "queen_psqt", "SQUARE_NO", queen_psqt, SQUARE_NO, true, 8);
+    write_param(out, nullptr, "king_psqt", "SQUARE_NO", king_psqt, SQUARE_NO, true, 8);
+    write_param(out, "// Knight outposts (TOGA Log Manual inspired)",
+                "knight_outposts", "SQUARE_NO", knight_outposts, SQUARE_NO, true, 8);
+
+    out << "\n#endif // PARAMS_H_\n";
+    return static_cast<bool>(out);
+}
+
 void tune() {
     /*init*/
+    // A small table, since it's cleared before evaluating every batch
+    tt.resize(1);
+    tt.clear();
     register_parameters();
     gradients.resize(parameters.size());
     load_datapoints(dataset);
@@ -336,4 +486,9 @@ void tune() {
     adam();
 
     print_parameters(best_parameters);
+    if (write_params(params_path)) {
+        std::cout << "Parameters written to " << params_path << std::endl;
+    }
 }
+
+#endif // TUNING
@@ -37,11 +37,46 @@ typedef struct {
 } batch_t;
 
 
-typedef struct {
+// Which part of a packed score a parameter tunes (both parts are tuned as
+// one parameter if they're tied)
+enum class PART : int { MG, EG, BOTH };
+
+typedef struct param_t {
     std::string name;
-    int *value;
+    // A plain parameter, or (if nullptr) a part of the packed score
+    int *value = nullptr;
+    score_t *score = nullptr;
+    PART part = PART::BOTH;
+
+    inline int get() const {
+        if (value) return *value;
+        return part == PART::EG ? eg_value(*score) : mg_value(*score);
+    }
+
+    inline void set(int v) {
+        if (value) {
+            *value = v;
+        } else if (part == PART::MG) {
+            *score = S(v, eg_value(*score));
+        } else if (part == PART::EG) {
+            *score = S(mg_value(*score), v);
+        } else {
+            *score = S(v, v);
+        }
+    }
 } param_t;
 
+#ifdef TUNING
+
+/**
+ @brief Writes the current values of the evaluation parameters to a header
+ (the source of params.h, which the tuning build can then replace)
+ @return True on success
+ */
+bool write_params(const std::string &path);
+
 void tune();
 
+#endif // TUNING
+
 #endif // SGD_H_
@@ -16,10 +16,275 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-/* @TODO: This file will hold thread pool code for LazySMP in the future */
+/* Thread pool for LazySMP */
 #include "threads.h"
 
-#include "eval.h" // eval_t
+#include <algorithm> // std::max
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "transposition.h"
+
+// Pool of search threads
+std::vector<std::unique_ptr<thread_t>> threads;
+
+namespace {
+
+// A logical CPU and the NUMA node it belongs to
+typedef struct cpu_t {
+    int id;
+    int node;
+} cpu_t;
+
+// Whether the threads are pinned to cores
+bool numa_pinning = false;
+
+// Parses a sysfs cpulist like "0-7,16-23" into the ids of the cpus
+std::vector<int> parse_cpulist(const std::string &cpulist) {
+    std::vector<int> cpus;
+    std::istringstream iss(cpulist);
+    std::string range;
+    while (std::getline(iss, range, ',')) {
+        size_t dash = range.find('-');
+        int first = std::atoi(range.c_str());
+        int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Returns the cpus of the machine ordered node by node. Without NUMA
+// information (non-Linux systems), all cpus are assumed to be on node 0
+const std::vector<cpu_t>& numa_cpus() {
+    static std::vector<cpu_t> cpus;
+    if (!cpus.empty()) {
+        return cpus;
+    }
+
+    for (int node = 0; ; ++node) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string cpulist;
+        if (!file.is_open() || !std::getline(file, cpulist)) {
+            break;
+        }
+        for (int cpu : parse_cpulist(cpulist)) {
+            cpus.push_back({cpu, node});
+        }
+    }
+
+    if (cpus.empty()) {
+        for (int cpu = 0; cpu < MAX(1, (int)std::thread::hardware_concurrency()); ++cpu) {
+            cpus.push_back({cpu, 0});
+        }
+    }
+    return cpus;
+}
+
+// Pins the thread to its core (or unpins it, if pinning is disabled)
+void bind_thread([[maybe_unused]] thread_t *thread) {
+#ifdef __linux__
+    const std::vector<cpu_t> &cpus = numa_cpus();
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (numa_pinning) {
+        CPU_SET(cpus[thread->id % cpus.size()].id, &cpuset);
+    } else {
+        for (const cpu_t &cpu : cpus) {
+            CPU_SET(cpu.id, &cpuset);
+        }
+    }
+    pthread_setaffinity_np(thread->native.native_handle(), sizeof(cpu_set_t), &cpuset);
+#endif
+}
+
+} // namespace
+
+void thread_t::start_searching() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        searching = true;
+    }
+    cv.notify_one();
+}
+
+void thread_t::wait_for_search_finished() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !searching; });
+}
+
+thread_t::~thread_t() {
+    if (!native.joinable()) {
+        return;
+    }
+    wait_for_search_finished();
+    exit = true;
+    start_searching();
+    native.join();
+}
+
+void idle_loop(thread_t *thread) {
+    LOG("Thread " << thread->id << " started!");
+    while (true) {
+        std::unique_lock<std::mutex> lock(thread->mutex);
+        thread->searching = false;
+        // Wake up anyone waiting for the search to finish
+        thread->cv.notify_one();
+        thread->cv.wait(lock, [thread] { return thread->searching; });
+
+        if (thread->exit) {
+            break;
+        }
+
+        lock.unlock();
+
+        // The main thread handles the UCI request, helpers only search
+        if (thread->task) {
+            thread->task(thread);
+            thread->task = nullptr;
+        } else if (thread->id == 0) {
+            engine_loop(thread->board, thread->info);
+        } else {
+            iterative_deepening(thread);
+        }
+    }
+    LOG("Thread " << thread->id << " done!");
+}
+
+void set_threads(int n) {
+    n = MAX(1, n);
+    LOG("Resizing the thread pool to " << n << " threads");
+
+    // Make sure none of the threads are searching while resizing the pool
+    if (!threads.empty()) {
+        threads[0]->wait_for_search_finished();
+    }
+
+    while (static_cast<int>(threads.size()) > n) {
+        threads.pop_back();
+    }
+    while (static_cast<int>(threads.size()) < n) {
+        threads.push_back(std::make_unique<thread_t>());
+        thread_t *thread = threads.back().get();
+        thread->id = threads.size() - 1;
+        thread->native = std::thread(idle_loop, thread);
+        // Block until the thread is parked in its idle loop
+        thread->wait_for_search_finished();
+        bind_thread(thread);
+    }
+}
+
+void run_on_threads(const std::function<void(thread_t*)> &task) {
+    threads[0]->wait_for_search_finished();
+    for (auto& thread : threads) {
+        thread->task = task;
+        thread->start_searching();
+    }
+    for (auto& thread : threads) {
+        thread->wait_for_search_finished();
+    }
+}
+
+bool set_numa_pinning(bool enabled) {
+    threads[0]->wait_for_search_finished();
+    bool was_enabled = numa_pinning;
+    numa_pinning = enabled;
+    for (auto& thread : threads) {
+        bind_thread(thread.get());
+    }
+    return was_enabled;
+}
+
+int numa_node(const thread_t *thread) {
+    const std::vector<cpu_t> &cpus = numa_cpus();
+    return numa_pinning ? cpus[thread->id % cpus.size()].node : 0;
+}
+
+void run_on_slices(const std::function<void(size_t, size_t)> &task) {
+    // Every thread of the pool processes its own slice (placing the pages it
+    // touches first on its NUMA node), the cores left idle by the pool help
+    // with extra slices
+    const size_t pool_size = threads.size();
+    const size_t slices = std::max<size_t>(pool_size, std::thread::hardware_concurrency());
+    std::vector<std::thread> helpers;
+    for (size_t i = pool_size; i < slices; ++i) {
+        helpers.emplace_back([&task, i, slices]() { task(i, slices); });
+    }
+    run_on_threads([&task, slices](thread_t *thread) {
+        task(thread->id, slices);
+    });
+    for (std::thread &helper : helpers) {
+        helper.join();
+    }
+}
+
+void clear_tt() {
+    run_on_slices([](size_t i, size_t n) { tt.clear(i, n); });
+}
+
+void allocate_tt() {
+    if (!tt.resize_pending()) {
+        return;
+    }
+    std::string path = tt.take_pending_file();
+    if (!path.empty()) {
+        if (tt.load(path)) {
+            std::cout << "info string Hash " << tt.size_MB() << "MB loaded from "
+                      << path << std::endl;
+            return;
+        }
+        std::cout << "info string Cannot load a compatible hash from "
+                  << path << std::endl;
+    }
+    const std::string &name = tt.shared_segment();
+    if (!name.empty()) {
+        if (tt.attach(name)) {
+            std::cout << "info string Hash " << tt.size_MB() << "MB shared via " << name
+                      << " (" << tt.attached_no() << " attached)" << std::endl;
+            return;
+        }
+        std::cout << "info string Cannot attach to a compatible shared hash "
+                  << name << std::endl;
+    }
+    // Resizing the table in use migrates its entries into the new table
+    // (the new table is zeroed, its pages get placed by the migration)
+    if (tt.migratable()) {
+        TT next;
+        if (tt.allocate_successor(next)) {
+            run_on_slices([&next](size_t i, size_t n) { tt.migrate(next, i, n); });
+            tt.replace(next);
+            std::cout << "info string Hash " << tt.size_MB() << "MB (entries migrated) backed by "
+                      << tt.pages_info() << std::endl;
+            return;
+        }
+    }
+    tt.resize(tt.size_MB());
+    clear_tt();
+    std::cout << "info string Hash " << tt.size_MB() << "MB backed by "
+              << tt.pages_info() << std::endl;
+}
+
+uint64_t nodes_searched() {
+    uint64_t nodes = 0ULL;
+    for (const auto& thread : threads) {
+        nodes += thread->info->nodes_no();
+    }
+    return nodes;
+}
+
+tt_stats_t tt_stats_searched() {
+    tt_stats_t stats;
+    for (const auto& thread : threads) {
+        stats.add(thread->tt_stats);
+    }
+    return stats;
+}
 
 // Engine loop never writes to the state variable, only reads
 void engine_loop(board_t *board, searchinfo_t *info) {
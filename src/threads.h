@@ -23,10 +23,16 @@
 #include <iostream>
 #include <string>
 #include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #include "types.h"
 #include "board.h"
 #include "search.h"
+#include "eval.h"
 #include "time.h" // now()
 
 enum { ENGINE_STOPPED, ENGINE_SEARCHING, ENGINE_PONDERING, ENGINE_QUIT };
@@ -39,9 +45,127 @@ enum { ENGINE_STOPPED, ENGINE_SEARCHING, ENGINE_PONDERING, ENGINE_QUIT };
 // down to nodes & (CHECKUP_INTERVAL - 1)
 constexpr int CHECKUP_INTERVAL = 1 << 12; // == 4096
 
+/**
+ @brief Search data private to a single search thread (LazySMP). Only the
+ transposition table is global and shared between the threads
+ */
+typedef struct thread_t {
+    // Index of the thread in the pool (the main thread has id 0)
+    int id = 0;
+    // The thread's own copy of the position being searched
+    board_t board[1];
+    // Search info of the thread. The main thread searches with the info
+    // owned by the UCI loop, helper threads with their own copy of it
+    searchinfo_t own_info[1];
+    searchinfo_t *info = own_info;
+    // Search stack (killers, static evaluations)
+    stack_t stack[MAX_DEPTH+1] = {};
+    // Triangular PV table, indexed by [ply]
+    pv_line pv_tb[MAX_DEPTH+1];
+    // Pawn & material hash tables, evaluation cache
+    pawn_table_t pawn_table;
+    material_table_t material_table;
+    eval_cache_t eval_cache;
+    // Evaluation data
+    eval_t eval = { .pawn_table = &pawn_table, .material_table = &material_table,
+                    .eval_cache = &eval_cache };
+    // History heuristic
+    history_t history_h = {};
+    // Statistics of the thread's use of the transposition table
+    // (of its last or current search)
+    tt_stats_t tt_stats;
+    // Native thread, parked in idle_loop() in between searches
+    std::thread native;
+    // Guards 'searching' and 'exit', the native thread waits on the
+    // condition variable until woken up for the next search
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool searching = true;
+    bool exit = false;
+    // Task to execute instead of a search when woken up (see run_on_threads())
+    std::function<void(thread_t*)> task;
+
+    // Wakes up the native thread to start searching
+    void start_searching();
+    // Blocks until the native thread finishes its current search
+    void wait_for_search_finished();
+    // Terminates and joins the native thread (if any)
+    ~thread_t();
+} thread_t;
+
+// Pool of search threads in threads.cpp (threads[0] is the main thread)
+extern std::vector<std::unique_ptr<thread_t>> threads;
+
+/**
+ @brief Resizes the pool of search threads
+ @param n number of search threads (including the main thread)
+ */
+void set_threads(int n);
+
+// Returns the number of nodes searched by all threads in the pool
+uint64_t nodes_searched();
+
+// Returns the transposition table statistics summed over all threads in the pool
+tt_stats_t tt_stats_searched();
+
+/**
+ @brief Runs the task on every thread of the pool (in parallel) and blocks
+ until all of the threads are done. Must not be called during a search
+ @param task the task to execute, receives the executing thread
+ */
+void run_on_threads(const std::function<void(thread_t*)> &task);
+
+/**
+ @brief Pins the threads of the pool to cores, filling up the cores of one
+ NUMA node before moving on to the next one. When disabled, the OS is free
+ to schedule the threads on any core
+ @param enabled whether to pin the threads
+ @returns whether the threads were pinned before the call
+ */
+bool set_numa_pinning(bool enabled);
+
+// Returns the NUMA node the thread is pinned to (0 if pinning is disabled)
+int numa_node(const thread_t *thread);
+
+/**
+ @brief Runs the task over equally sized slices of some work in parallel:
+ each thread of the pool runs the slice of its id, helper threads run the
+ extra slices for the cores left idle by the pool. Must not be called during
+ a search
+ @param task the task to execute, receives the index & the number of slices
+ */
+void run_on_slices(const std::function<void(size_t, size_t)> &task);
+
+/**
+ @brief Clears the transposition table in parallel. Each thread of the pool
+ zeroes its own slice of the table, so that with NUMA pinning enabled the
+ pages of the slice are first touched (and hence allocated) on the thread's node
+ */
+void clear_tt();
+
+/**
+ @brief (Re)allocates the transposition table if its size was changed
+ since its last allocation & clears it (or loads it from the requested
+ hash file, see TT::request_file(), or attaches it to the requested shared
+ memory segment, see TT::request_shared()), otherwise does nothing. Resizing
+ the table in use migrates its entries into the new table in parallel. The table's
+ allocation is deferred until it's needed (isready/go), so that changing
+ the Hash and other options at startup doesn't allocate & clear it repeatedly
+ */
+void allocate_tt();
+
+/**
+ @brief Loop executed by the native thread of every thread in the pool.
+ The thread sleeps until woken up by start_searching(), runs the search
+ and goes back to sleep, so that the threads (and their search data)
+ live across searches
+ @param thread the thread in the pool
+ */
+void idle_loop(thread_t *thread);
+
 // Checks whether the search thread should checkup with the UCI thread
 inline bool checkup_needed(const searchinfo_t *info) {
-    return (info->nodes & (CHECKUP_INTERVAL-1)) == 0;
+    return (info->nodes_no() & (CHECKUP_INTERVAL-1)) == 0;
 }
 
 // Checks if the search was stopped
@@ -58,32 +182,37 @@ inline bool search_stopped(const searchinfo_t *info) {
 void engine_loop(board_t *board, searchinfo_t *info);
 
 /**
- @brief Starts the search on the provided thread for the given
+ @brief Starts the search on the main thread of the pool for the given
 board and search information provided
- @param search_thread thread to execute the search routine
  @param board board struct representing the position to be searched
  @param info pointer to a searchinfo_t struct storing search requirements
  like depth, time, etc.
  */
-inline void search_start(std::thread &search_thread, board_t *board,
-                         searchinfo_t *info) {
+inline void search_start(const board_t *board, searchinfo_t *info) {
+  thread_t *main_thread = threads[0].get();
+  main_thread->wait_for_search_finished();
+  allocate_tt();
+  *main_thread->board = *board;
+  main_thread->info = info;
   info->state = ENGINE_SEARCHING;
   LOG("Starting search");
-  search_thread = std::thread(engine_loop, board, info);
+  main_thread->start_searching();
+}
+
+// Blocks until the main thread of the pool reports the best move
+inline void search_wait() {
+    threads[0]->wait_for_search_finished();
 }
 
 /**
- @brief Stops any search on the provided thread
- @param search_thread thread currently executing a search routine
+ @brief Stops any ongoing search
+ @param info search info of the ongoing search
  */
-inline void search_stop(std::thread &search_thread, searchinfo_t *info) {
+inline void search_stop(searchinfo_t *info) {
     info->state = ENGINE_STOPPED;
-    if (!search_thread.joinable()) {
-        return;
-    }
 
     LOG("Blocking until thread stops the search...");
-    search_thread.join();
+    search_wait();
     LOG("Done!");
 }
 
@@ -20,6 +20,22 @@
 #include "transposition.h"
 
 #include <cstring> // std::memset
+#include <cstdio>  // std::sscanf
+#include <cstdlib> // std::calloc, std::free
+#include <atomic>  // std::atomic_ref
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <algorithm> // std::min
+#include <iomanip>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/mman.h> // mmap, madvise
+#include <sys/stat.h> // fstat
+#include <fcntl.h>    // open, shm_open
+#include <unistd.h>   // close, ftruncate
+#endif
 
 #include "search.h"
 #include "movegen.h"
@@ -34,104 +50,757 @@
 // Default TT size in MB
 constexpr int DEFAULTTTSIZEMB = 128;
 
+// Size of a (x86-64) huge page
+constexpr size_t HUGE_PAGE_SIZE = 2 * BYTES_PER_MB;
+
+namespace {
+
+// The words of an entry are read & written with relaxed atomics: the stores
+// of concurrent threads can interleave, but no single word can be torn
+inline uint64_t load_word(const uint64_t &word) {
+    return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(word)).load(std::memory_order_relaxed);
+}
+
+inline void store_word(uint64_t &word, uint64_t value) {
+    std::atomic_ref<uint64_t>(word).store(value, std::memory_order_relaxed);
+}
+
+// Counts an event in the statistics of the thread (the only thread writing
+// to them, hence no locked increment is needed)
+inline void count(uint64_t &counter, uint64_t n = 1) {
+    store_word(counter, load_word(counter) + n);
+}
+
+// Returns the i-th compact entry of a bucket
+inline uint64_t &compact_word(tt_bucket *bucket, int i) {
+    tt_entry &entry = bucket->entries[i >> 1];
+    return (i & 1) ? entry.data : entry.key;
+}
+
+// How valuable an entry is to keep in the table when storing a new entry in
+// its bucket: deeper entries save more work, exact scores are worth more
+// than bounds and entries from older searches are probably useless by now
+inline int worth(const tt_entry &entry, uint8_t gen) {
+    const int age = (gen - entry.age() + GENERATIONS) % GENERATIONS;
+    return entry.depth() + 2 * (entry.flags() == EXACT) - 8 * age;
+}
+
+#ifdef DEBUG
+// Data of the test entries of a position, derived from its key alone
+// (hence every hit can be verified)
+uint64_t test_data(uint64_t key) {
+    move_t move  = (key >> 40) & 0xffff;
+    int score = static_cast<int>((key >> 20) % 2001) - 1000;
+    int depth = static_cast<int>(key % 64);
+    int flags = static_cast<int>(1 + (key >> 8) % 3); // UPPER, LOWER or EXACT
+    int eval = static_cast<int>((key >> 4) % 2001) - 1000;
+    return tt_entry::pack(move, score, depth, flags, 0, eval);
+}
+
+// Takes back all the moves played, back to the starting position
+// (undoing them keeps the debug build's reference boards in sync)
+void restart(board_t *board) {
+    while (board->history_ply > 0) {
+        undo_move(board);
+    }
+}
+
+// Plays a random legal move, starting anew from the starting position once
+// max_ply moves have been played (or the game is over)
+void random_move(board_t *board, uint64_t &rng, int max_ply) {
+    if (board->history_ply >= max_ply) {
+        restart(board);
+    }
+    movelist_t moves;
+    generate_moves(board, &moves);
+    rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17; // xorshift64
+    for (size_t i = 0; i < moves.size(); ++i) {
+        if (make_move(board, moves[(rng + i) % moves.size()])) {
+            return;
+        }
+    }
+    // Checkmate or stalemate
+    restart(board);
+    random_move(board, rng, max_ply);
+}
+#endif
+
+// Returns the key of the starting position (depends on the Zobrist keys)
+uint64_t start_key() {
+    board_t board[1];
+    setup(board, start_FEN);
+    return board->key;
+}
+
+// Returns the lowest key indexing into the b-th bucket of a table of size
+// buckets, i.e. the lowest key with (key * size) >> 64 == b
+uint64_t first_key(size_t b, size_t size) {
+    __extension__ using uint128_t = unsigned __int128;
+    return static_cast<uint64_t>(((static_cast<uint128_t>(b) << 64) + size - 1) / size);
+}
+
+// Returns the highest key indexing into the b-th bucket of a table of size buckets
+uint64_t last_key(size_t b, size_t size) {
+    return b + 1 == size ? UINT64_MAX : first_key(b + 1, size) - 1;
+}
+
+// Returns the number of bytes of the memory mapped at [mem, mem + bytes)
+// actually backed by transparent huge pages, as reported by the kernel
+// (madvise only asks for them, the kernel may still back the memory by
+// regular pages, e.g. if THP are disabled or no huge pages are free)
+size_t huge_page_bytes(const void *mem, size_t bytes) {
+    size_t huge_kB = 0;
+    #ifdef __linux__
+    const uintptr_t first = reinterpret_cast<uintptr_t>(mem);
+    const uintptr_t last = first + bytes;
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inside = false;
+    while (std::getline(smaps, line)) {
+        // Each mapping starts with a line of its address range, followed
+        // by lines of "Field: value kB" (the mapping may have been split)
+        unsigned long start, end;
+        if (std::sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+            inside = first <= start && end <= last;
+            continue;
+        }
+        size_t kB;
+        if (inside && (std::sscanf(line.c_str(), "AnonHugePages: %zu kB", &kB) == 1
+                    || std::sscanf(line.c_str(), "ShmemPmdMapped: %zu kB", &kB) == 1)) {
+            huge_kB += kB;
+        }
+    }
+    #else
+    (void)mem; (void)bytes;
+    #endif
+    return huge_kB * 1024;
+}
+
+// Returns whether a saved (or shared) table has the expected entry layout
+// and was filled using the same Zobrist keys & evaluator
+bool compatible(const tt_file_header &header, const tt_file_header &expected) {
+    return std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+        && header.version == expected.version
+        && header.entry_size == expected.entry_size
+        && header.bucket_size == expected.bucket_size
+        && header.zobrist_seed == expected.zobrist_seed
+        && header.start_key == expected.start_key
+        && header.eval_source == expected.eval_source
+        && header.buckets > 0;
+}
+
+} // namespace
+
 // Global transposition table
 TT tt(DEFAULTTTSIZEMB);
 
-TT::TT(const int MB) : size{(0x100000 * MB / sizeof(tt_entry))} {
-    this->resize(MB);
-}
+TT::TT(const int MB) : pending_MB{MB} {}
 
 TT::~TT() {
     //if (table != nullptr) {
         //delete[] table;
     //}
 
-    // delete is safe to use on nullptrs
-    delete[] table;
+    deallocate();
+}
+
+bool TT::allocate() {
+    // The table is allocated zeroed (i.e. cleared) but untouched: the pages
+    // get placed on the NUMA node of the thread first writing to them
+    // (see clear_tt() in threads.h)
+    table_compact = compact;
+    table_eval_source = eval_source;
+    #ifdef __linux__
+    if (huge_pages) {
+        // Huge pages can only back whole huge pages
+        const size_t bytes = (size * sizeof(tt_bucket) + HUGE_PAGE_SIZE - 1)
+                           & ~(HUGE_PAGE_SIZE - 1);
+        void *mem = MAP_FAILED;
+        #ifdef MAP_HUGETLB
+        // Fails unless huge pages have been reserved (vm.nr_hugepages)
+        mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        pages = HUGETLB_PAGES;
+        #endif
+        if (mem == MAP_FAILED) {
+            mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            pages = REGULAR_PAGES;
+            #ifdef MADV_HUGEPAGE
+            if (mem != MAP_FAILED && madvise(mem, bytes, MADV_HUGEPAGE) == 0) {
+                pages = TRANSPARENT_HUGE_PAGES;
+            }
+            #endif
+        }
+        if (mem != MAP_FAILED) {
+            // mmap-ed memory is page-aligned
+            memory = table = static_cast<tt_bucket*>(mem);
+            mapped = bytes;
+            return true;
+        }
+    }
+    #endif
+
+    // One extra bucket is allocated to align the buckets to cache lines
+    memory = std::calloc(this->size + 1, sizeof(tt_bucket));
+    table = reinterpret_cast<tt_bucket*>(
+            (reinterpret_cast<uintptr_t>(memory) + alignof(tt_bucket) - 1)
+            & ~static_cast<uintptr_t>(alignof(tt_bucket) - 1));
+    mapped = 0;
+    pages = REGULAR_PAGES;
+    return memory != nullptr;
+}
+
+void TT::deallocate() {
+    #ifdef __linux__
+    if (shared_header) {
+        // The last process to detach removes the segment
+        if (std::atomic_ref<uint32_t>(shared_header->attached).fetch_sub(1) == 1) {
+            shm_unlink(attached_name.c_str());
+        }
+        shared_header = nullptr;
+        attached_name.clear();
+    }
+    if (mapped) {
+        munmap(memory, mapped);
+        memory = table = nullptr;
+        mapped = 0;
+        return;
+    }
+    #endif
+    // free is safe to use on nullptrs
+    std::free(memory);
+    memory = table = nullptr;
+}
+
+bool TT::set_huge_pages(bool enabled) {
+    bool previous = huge_pages;
+    huge_pages = enabled;
+    return previous;
+}
+
+bool TT::save(const std::string &path) const {
+    // (the layout of the allocated table, which differs from the requested
+    // one until the table gets reallocated)
+    tt_file_header header;
+    header.entry_size = table_compact ? sizeof(uint64_t) : sizeof(tt_entry);
+    header.bucket_size = table_compact ? COMPACT_BUCKET_SIZE : BUCKET_SIZE;
+    header.buckets = size;
+    header.start_key = start_key();
+    header.eval_source = table_eval_source;
+    header.gen = gen;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(table), size * sizeof(tt_bucket));
+    return file.good();
+}
+
+bool TT::load(const std::string &path) {
+    #ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    // The table must have been saved with the same entry layout
+    struct stat st;
+    tt_file_header header, expected;
+    expected.entry_size = compact ? sizeof(uint64_t) : sizeof(tt_entry);
+    expected.bucket_size = bucket_size();
+    expected.start_key = start_key();
+    expected.eval_source = eval_source;
+    bool valid = fstat(fd, &st) == 0
+              && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+              && compatible(header, expected)
+              && static_cast<uint64_t>(st.st_size)
+                  == sizeof(header) + header.buckets * sizeof(tt_bucket);
+
+    // The pages are only read in from the file once they're accessed, and
+    // the search writes to private copies of them
+    void *mem = valid ? mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE, fd, 0)
+                      : MAP_FAILED;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    deallocate();
+    memory = mem;
+    mapped = st.st_size;
+    table = reinterpret_cast<tt_bucket*>(static_cast<char*>(mem) + sizeof(header));
+    table_compact = compact;
+    table_eval_source = eval_source;
+    size = header.buckets;
+    pages = REGULAR_PAGES;
+    pending_MB = 0;
+    gen = static_cast<uint8_t>(header.gen % GENERATIONS);
+    return true;
+    #else
+    (void)path;
+    return false;
+    #endif
+}
+
+bool TT::attach(const std::string &name, bool recreate) {
+    #ifdef __linux__
+    // The header of the segment, if this process gets to create it
+    tt_file_header expected;
+    expected.entry_size = compact ? sizeof(uint64_t) : sizeof(tt_entry);
+    expected.bucket_size = bucket_size();
+    expected.buckets = (BYTES_PER_MB * size_MB()) / sizeof(tt_bucket);
+    expected.start_key = start_key();
+    expected.eval_source = eval_source;
+    size_t bytes = sizeof(expected) + expected.buckets * sizeof(tt_bucket);
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    const bool creator = fd >= 0;
+    if (!creator) {
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    // A fresh segment is zeroed (i.e. cleared) once sized. An existing one
+    // might be yet to be sized by its creator
+    bool sized = false;
+    struct stat st = {};
+    if (creator) {
+        sized = ftruncate(fd, bytes) == 0;
+    } else {
+        for (int i = 0; i < 1000 && !sized; ++i) {
+            sized = fstat(fd, &st) == 0 && st.st_size > 0;
+            if (!sized) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        bytes = sized ? st.st_size : 0;
+        sized = sized && bytes >= sizeof(tt_file_header);
+    }
+    void *mem = sized ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                      : MAP_FAILED;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        if (creator) shm_unlink(name.c_str());
+        return false;
+    }
+
+    tt_file_header *header = static_cast<tt_file_header*>(mem);
+    std::atomic_ref<uint32_t> attached(header->attached);
+    if (creator) {
+        // Setting the count publishes the header to the other processes
+        *header = expected;
+        attached.store(1, std::memory_order_release);
+    } else {
+        // Wait for the header to be published, then attach unless the count
+        // has dropped back to zero (the segment is being removed)
+        uint32_t count = 0;
+        for (int i = 0; i < 1000 && !count; ++i) {
+            count = attached.load(std::memory_order_acquire);
+            if (!count) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (!count) {
+            // The creator died before publishing the header (or the last
+            // process is removing the segment): remove the stale segment,
+            // unless it has been replaced by another process meanwhile, and
+            // create a fresh one
+            munmap(mem, bytes);
+            if (!recreate) {
+                return false;
+            }
+            struct stat current;
+            int current_fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if (current_fd >= 0) {
+                if (fstat(current_fd, &current) == 0 && current.st_ino == st.st_ino) {
+                    shm_unlink(name.c_str());
+                }
+                close(current_fd);
+            }
+            return attach(name, false);
+        }
+        bool valid = compatible(*header, expected)
+                  && bytes == sizeof(tt_file_header) + header->buckets * sizeof(tt_bucket);
+        while (valid && !attached.compare_exchange_weak(count, count + 1,
+                                                        std::memory_order_acq_rel)) {
+            valid = count != 0;
+        }
+        if (!valid) {
+            munmap(mem, bytes);
+            return false;
+        }
+    }
+
+    // (the previous table is released only now, so that re-attaching to
+    // the same segment doesn't remove it)
+    deallocate();
+    memory = mem;
+    mapped = bytes;
+    table = reinterpret_cast<tt_bucket*>(static_cast<char*>(mem) + sizeof(tt_file_header));
+    table_compact = compact;
+    table_eval_source = eval_source;
+    size = header->buckets;
+    pages = REGULAR_PAGES;
+    #ifdef MADV_HUGEPAGE
+    // (backed by huge pages only if enabled for shared memory, see
+    // /sys/kernel/mm/transparent_hugepage/shmem_enabled)
+    if (huge_pages && madvise(mem, bytes, MADV_HUGEPAGE) == 0) {
+        pages = TRANSPARENT_HUGE_PAGES;
+    }
+    #endif
+    pending_MB = 0;
+    gen = static_cast<uint8_t>(std::atomic_ref<uint32_t>(header->gen).load() % GENERATIONS);
+    shared_header = header;
+    attached_name = name;
+    return true;
+    #else
+    (void)name;
+    return false;
+    #endif
+}
+
+uint32_t TT::attached_no() const {
+    return shared_header ? std::atomic_ref<uint32_t>(shared_header->attached).load() : 0;
+}
+
+void TT::age() {
+    // The processes sharing a table search independently, advancing the
+    // generation on every search of any of them would make the entries of
+    // the others' current searches look stale (and wrap the age around
+    // within a few moves), hence a shared table isn't aged
+    if (shared_header) {
+        return;
+    }
+    this->gen = (this->gen + 1) % GENERATIONS;
+}
+
+std::string TT::pages_info() const {
+    switch (pages) {
+        case HUGETLB_PAGES: return "huge pages";
+        case TRANSPARENT_HUGE_PAGES: {
+            // Only the pages touched so far are backed by anything
+            const size_t huge = huge_page_bytes(memory, mapped);
+            if (huge == 0) {
+                return "regular pages (transparent huge pages requested)";
+            }
+            return "transparent huge pages (" + std::to_string(huge / BYTES_PER_MB)
+                 + " of " + std::to_string(mapped / BYTES_PER_MB) + "MB)";
+        }
+        default: return "regular pages";
+    }
 }
 
 void TT::resize(const int new_size_MB) {
     if (new_size_MB <= 0) {
         TRACE_TT("Illegal TT size, defaulting to " << DEFAULTTTSIZEMB);
         this->resize(DEFAULTTTSIZEMB);
+        return;
     }
     TRACE_TT("Allocating TT of size " << new_size_MB << "MB");
 
-    delete[] table;
-    this->size = (0x100000 * new_size_MB) / sizeof(tt_entry);
-    table = new tt_entry[this->size];
-    if (table == nullptr) {
+    deallocate();
+    this->pending_MB = 0;
+    this->size = (BYTES_PER_MB * new_size_MB) / sizeof(tt_bucket);
+    if (!allocate()) {
         std::cerr << "Transposition table allocation failed! Retrying with size "
             << new_size_MB / 2 << std::endl;
         this->resize(new_size_MB / 2);
+        return;
     }
-    this->clear();
 
     TRACE_TT("Transposition table successfully resized to " << new_size_MB << "MB!");
 }
 
-void TT::reset_stats() {
-    overwrites = hit = cut = 0U;
+bool TT::migratable() const {
+    return table != nullptr && !shared() && table_compact == compact
+        && table_eval_source == eval_source
+        && pending_file.empty() && shared_name.empty();
+}
+
+bool TT::allocate_successor(TT &next) const {
+    next.compact = compact;
+    next.eval_source = eval_source;
+    next.huge_pages = huge_pages;
+    next.size = (BYTES_PER_MB * size_MB()) / sizeof(tt_bucket);
+    next.gen = gen;
+    next.pending_MB = 0;
+    return next.allocate();
+}
+
+void TT::migrate(TT &next, size_t i, size_t n) const {
+    // The slice of the successor's buckets, [first, last)
+    const size_t first = next.size * i / n;
+    const size_t last = next.size * (i + 1) / n;
+    if (first == last) {
+        return;
+    }
+    tt_bucket *const begin = next.table + first;
+    tt_bucket *const end = next.table + last;
+
+    // The positions indexing into the slice have keys in [lo, hi], and
+    // both tables map keys onto buckets monotonically
+    tt_bucket *from = bucket(first_key(first, next.size));
+    tt_bucket *to = bucket(last_key(last - 1, next.size));
+    for (tt_bucket *src = from; src <= to; ++src) {
+        const size_t b = src - table;
+        const uint64_t lo = first_key(b, size);
+        const uint64_t hi = last_key(b, size);
+        for (int s = 0; s < bucket_size(); ++s) {
+            const tt_entry entry = read_slot(src, s, lo);
+            if (entry.key == 0ULL) {
+                continue;
+            }
+            if (!compact) {
+                tt_bucket *dst = next.bucket(entry.pos_key());
+                if (begin <= dst && dst < end) {
+                    next.place(dst, entry.pos_key(), entry);
+                }
+                continue;
+            }
+            // A compact entry only stores the 16 least-significant bits of
+            // the key, it's only migrated if all the positions it may belong
+            // to index the same bucket (i.e. when the table doesn't grow).
+            // Copies in every bucket it may index would fill a grown table
+            // with entries mostly matched by other positions only
+            tt_bucket *dst = next.bucket(lo);
+            if (dst == next.bucket(hi) && begin <= dst && dst < end) {
+                next.place(dst, entry.pos_key(), entry);
+            }
+        }
+    }
+}
+
+void TT::replace(TT &next) {
+    deallocate();
+    memory = next.memory;
+    table = next.table;
+    table_compact = next.table_compact;
+    table_eval_source = next.table_eval_source;
+    size = next.size;
+    mapped = next.mapped;
+    pages = next.pages;
+    pending_MB = 0;
+    // The successor gives up its memory
+    next.memory = next.table = nullptr;
+    next.mapped = 0;
+    next.size = 0;
+}
+
+void TT::place(tt_bucket *bucket, uint64_t key, const tt_entry &entry) {
+    // Empty entries first, then the least valuable one
+    int slot = 0;
+    int slot_worth = INT32_MAX;
+    for (int i = 0; i < bucket_size(); ++i) {
+        tt_entry current = read_slot(bucket, i, key);
+        const int current_worth = current.key == 0ULL ? INT32_MIN : worth(current, gen);
+        if (current_worth < slot_worth) {
+            slot = i;
+            slot_worth = current_worth;
+        }
+    }
+    if (slot_worth < worth(entry, gen)) {
+        write_slot(bucket, slot, key, entry.data);
+    }
+}
+
+void tt_stats_t::clear() {
+    // (the other threads might be reading the statistics)
+    for (uint64_t *counter : {&writes, &updates, &overwrites, &collisions, &kept}) {
+        store_word(*counter, 0);
+    }
+    for (uint64_t &counter : bounds) {
+        store_word(counter, 0);
+    }
+    for (auto &depth_stats : probes) {
+        for (tt_probe_stats_t &stats : depth_stats) {
+            for (uint64_t *counter : {&stats.probes, &stats.found, &stats.hits, &stats.cuts}) {
+                store_word(*counter, 0);
+            }
+        }
+    }
+}
+
+void tt_stats_t::add(const tt_stats_t &other) {
+    writes += load_word(other.writes);
+    updates += load_word(other.updates);
+    overwrites += load_word(other.overwrites);
+    collisions += load_word(other.collisions);
+    kept += load_word(other.kept);
+    for (int flags = BAD; flags <= EXACT; ++flags) {
+        bounds[flags] += load_word(other.bounds[flags]);
+    }
+    for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+        for (int type = PV_NODE; type < NODE_TYPES; ++type) {
+            tt_probe_stats_t &stats = probes[depth][type];
+            const tt_probe_stats_t &other_stats = other.probes[depth][type];
+            stats.probes += load_word(other_stats.probes);
+            stats.found += load_word(other_stats.found);
+            stats.hits += load_word(other_stats.hits);
+            stats.cuts += load_word(other_stats.cuts);
+        }
+    }
+}
+
+uint64_t tt_stats_t::probes_no() const {
+    uint64_t probes_total = 0;
+    for (const auto &depth_stats : probes) {
+        for (const tt_probe_stats_t &stats : depth_stats) {
+            probes_total += load_word(stats.probes);
+        }
+    }
+    return probes_total;
+}
+
+uint64_t tt_stats_t::found_no() const {
+    uint64_t found = 0;
+    for (const auto &depth_stats : probes) {
+        for (const tt_probe_stats_t &stats : depth_stats) {
+            found += load_word(stats.found);
+        }
+    }
+    return found;
+}
+
+void TT::print_stats(std::ostream &out, const tt_stats_t &stats) const {
+    // Share of part in whole, in percent
+    auto rate = [](uint64_t part, uint64_t whole) {
+        return whole ? 100.0 * static_cast<double>(part) / whole : 0.0;
+    };
+    auto print_probes = [&](const char *name, const tt_probe_stats_t &probe_stats) {
+        out << " " << name << " probes " << probe_stats.probes
+            << " found " << rate(probe_stats.found, probe_stats.probes) << "%"
+            << " hits " << rate(probe_stats.hits, probe_stats.probes) << "%"
+            << " cuts " << rate(probe_stats.cuts, probe_stats.probes) << "%";
+    };
+    out << std::fixed << std::setprecision(1);
+
+    /* Probes, in total & by depth (skipping the depths nothing probed) */
+    tt_probe_stats_t total;
+    for (const auto &depth_stats : stats.probes) {
+        for (const tt_probe_stats_t &probe_stats : depth_stats) {
+            total.probes += probe_stats.probes;
+            total.found += probe_stats.found;
+            total.hits += probe_stats.hits;
+            total.cuts += probe_stats.cuts;
+        }
+    }
+    out << "info string hash";
+    print_probes("total", total);
+    out << std::endl;
+    for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+        const tt_probe_stats_t &pv = stats.probes[depth][PV_NODE];
+        const tt_probe_stats_t &non_pv = stats.probes[depth][NON_PV_NODE];
+        if (pv.probes + non_pv.probes == 0) continue;
+        out << "info string hash depth " << depth;
+        print_probes("pv", pv);
+        print_probes("nonpv", non_pv);
+        out << std::endl;
+    }
+
+    /* Stores, by outcome & bound type */
+    const uint64_t stores = stats.writes + stats.updates + stats.overwrites;
+    out << "info string hash stores " << stores
+        << " empty " << rate(stats.writes, stores) << "%"
+        << " updates " << rate(stats.updates, stores) << "%"
+        << " overwrites " << rate(stats.overwrites, stores) << "%"
+        << " collisions " << stats.collisions
+        << " kept " << stats.kept
+        << " exact " << rate(stats.bounds[EXACT], stores) << "%"
+        << " lower " << rate(stats.bounds[LOWER], stores) << "%"
+        << " upper " << rate(stats.bounds[UPPER], stores) << "%" << std::endl;
+
+    /* Occupancy of the same sample of buckets as the hashfull's, by how
+     * many generations ago the entries were stored */
+    constexpr int AGES = 4; // The last one counts all the older entries
+    uint64_t aged[AGES] = {};
+    const size_t sampled = std::min<size_t>(1000, size);
+    for (size_t b = 0; b < sampled; ++b) {
+        for (int i = 0; i < bucket_size(); ++i) {
+            tt_entry entry = read_slot(&table[b], i, 0ULL);
+            if (entry.key == 0ULL) continue;
+            ++aged[std::min((gen - entry.age() + GENERATIONS) % GENERATIONS, AGES - 1)];
+        }
+    }
+    const uint64_t entries = sampled * bucket_size();
+    out << "info string hash occupancy";
+    for (int age = 0; age < AGES; ++age) {
+        out << " age" << age << (age == AGES - 1 ? "+ " : " ")
+            << rate(aged[age], entries) << "%";
+    }
+    out << std::defaultfloat << std::endl;
 }
 
 void TT::clear() {
-    // std::memset(table, 0, this->size * sizeof(tt_entry));
-    // std::fill(table, table + size, tt_entry());
-    tt_entry *entry;
-    for (entry = table; entry < table + size; ++entry) {
-        entry->key = 0ULL;
-        entry->depth = 0;
-        // entry->info = 0; // age = 0, flag = BAD = 0
-        entry->flags = BAD;
-        // entry->age = 0;
-        entry->move = NULLMV;
-        entry->score = 0;
+    this->clear(0, 1);
+}
+
+void TT::clear(size_t i, size_t n) {
+    // std::memset(table, 0, this->size * sizeof(tt_bucket));
+    // std::fill(table, table + size, tt_bucket());
+    tt_bucket *bucket;
+    for (bucket = table + size * i / n; bucket < table + size * (i + 1) / n; ++bucket) {
+        // (compact entries are cleared along with the words they're stored in)
+        for (tt_entry &entry : bucket->entries) {
+            // age = 0, flag = BAD = 0, move = NULLMV
+            entry.key = 0ULL;
+            entry.data = 0ULL;
+        }
+    }
+    if (i == 0) {
+        this->gen = 0;
     }
-    this->writes = 0;
-    // this->gen = 0;
-    reset_stats();
 }
 
-int TT::probe(const board_t *board, tt_entry *entry, move_t &move, int &score, int alpha, int beta, int depth) {
+int TT::probe(const board_t *board, tt_entry *entry, move_t &move, int &score, int alpha, int beta, int depth,
+              tt_stats_t *stats) {
 
     TRACE_TT("Probing " << board->key << " " << alpha << " " << beta << " " << depth);
 
-    // TODO: Ensure size of TT is a power of 2 for efficient mod with &
-    size_t idx = board->key % this->size;
-    *entry = table[idx];
+    tt_bucket *bucket = this->bucket(board->key);
 
-    assert(0 <= idx && idx <= this->size - 1);
+    assert(table <= bucket && bucket < table + this->size);
     assert(0 <= depth && depth < MAX_DEPTH);
     assert(alpha < beta);
     assert(-oo <= alpha && alpha <= +oo);
     assert(-oo <= beta && beta <= +oo);
     assert(0 <= board->ply && board->ply < MAX_DEPTH);
 
-    /* Check if the zobrist key matches */
-    if (entry->key != board->key) {
-        TRACE_TT("Key mismatch: " << entry->key << " vs " << board->key);
+    // (a pv node's window is open, a non-pv node's is null)
+    tt_probe_stats_t *probe_stats = stats
+        ? &stats->probes[depth][beta - alpha > 1 ? PV_NODE : NON_PV_NODE] : nullptr;
+    if (probe_stats) count(probe_stats->probes);
+
+    /* Look for an entry whose zobrist key matches (and that isn't torn) */
+    bool match = false;
+    for (int i = 0; i < bucket_size() && !match; ++i) {
+        *entry = read_slot(bucket, i, board->key);
+        match = entry->pos_key() == board->key;
+    }
+    if (!match) {
+        TRACE_TT("Key mismatch: " << board->key);
         return TTMISS;
     }
 
+    if (probe_stats) count(probe_stats->found);
+
     /* We have a match! Check if search was deep enough */
 
     // The move stored might be useful for move ordering
-    move = static_cast<move_t>(entry->move);
+    move = entry->move();
 
     // If the previous search wasn't as deep as current
-    //if (depth > static_cast<int>(entry->depth)) {
-    if (static_cast<int>(entry->depth) < depth) {
-        TRACE_TT("Depth insufficient: " << (int)entry->depth << " vs " << depth);
+    //if (depth > entry->depth()) {
+    if (entry->depth() < depth) {
+        TRACE_TT("Depth insufficient: " << entry->depth() << " vs " << depth);
         return TTMISS;
     }
 
-    assert(0 <= entry->depth && entry->depth < MAX_DEPTH);
+    assert(0 <= entry->depth() && entry->depth() < MAX_DEPTH);
 
     // Otherwise, we've hit a valid entry!
-    ++hit;
+    if (probe_stats) count(probe_stats->hits);
 
     // We overwrite the score
-    score = static_cast<int>(entry->score);
+    score = entry->score();
 
     // Adjust for mate scores
     if (score > +oo - MAX_DEPTH)
@@ -158,7 +827,7 @@ int TT::probe(const board_t *board, tt_entry *entry, move_t &move, int &score, i
 
     /* The entry can be useful. Check it's type */
     ///switch (static_cast<int>(entry->get_flag())) { // the 2 lsb store the entry flag
-    switch (static_cast<int>(entry->flags)) {
+    switch (entry->flags()) {
         case LOWER:
             if (score < beta) return TTMISS;
             score = beta; break;
@@ -168,31 +837,125 @@ int TT::probe(const board_t *board, tt_entry *entry, move_t &move, int &score, i
         case EXACT: break;
         case BAD: TRACE_TT("TODO: Not handled"); assert(false); break;
     }
+    if (probe_stats) count(probe_stats->cuts);
     return TTHIT;
 }
 
-// Always-replace replacement scheme
+int TT::hashfull() const {
+    // As is standard, only the first 1000 buckets are sampled
+    const size_t sampled = std::min<size_t>(1000, size);
+    uint64_t used = 0;
+    for (size_t b = 0; b < sampled; ++b) {
+        for (int i = 0; i < bucket_size(); ++i) {
+            tt_entry entry = read_slot(&table[b], i, 0ULL);
+            // (a shared table isn't aged, every entry is in use)
+            used += entry.key != 0ULL && (entry.age() == gen || shared_header);
+        }
+    }
+    return sampled ? static_cast<int>(used * 1000 / (sampled * bucket_size())) : 0;
+}
+
+tt_entry TT::read_slot(tt_bucket *bucket, int i, uint64_t key) const {
+    if (!compact) {
+        tt_entry &slot = bucket->entries[i];
+        return tt_entry{ load_word(slot.key), load_word(slot.data) };
+    }
+
+    const uint64_t word = load_word(compact_word(bucket, i));
+    if (word == 0ULL) {
+        return tt_entry{};
+    }
+    const int age = static_cast<int>(word >> 58);
+    const uint64_t data = tt_entry::pack(static_cast<move_t>((word >> 16) & 0xffff),
+                                         static_cast<int16_t>((word >> 32) & 0xffff),
+                                         static_cast<int>((word >> 48) & 0xff),
+                                         static_cast<int>((word >> 56) & 0x3),
+                                         age,
+                                         NO_EVAL);
+    const uint64_t pos_key = (key & ~0xffffULL) | (word & 0xffff);
+    return tt_entry{ pos_key ^ data, data };
+}
+
+void TT::write_slot(tt_bucket *bucket, int i, uint64_t key, uint64_t data) {
+    if (!compact) {
+        tt_entry &slot = bucket->entries[i];
+        store_word(slot.key, key ^ data);
+        store_word(slot.data, data);
+        return;
+    }
+
+    // Bits 0-31 (move & score) & 32-39 (depth) of the data word keep their
+    // order, flags & age get squeezed into a byte
+    const tt_entry entry{ key ^ data, data };
+    const uint64_t word = (key & 0xffff)
+                        | ((data & 0xffffffffffULL) << 16)
+                        | (static_cast<uint64_t>(entry.flags() & 0x3) << 56)
+                        | (static_cast<uint64_t>(entry.age() & 0x3f) << 58);
+    store_word(compact_word(bucket, i), word);
+}
+
+// Replacement scheme: an entry of the same position is updated unless it
+// was searched much deeper in the current search (and the new entry isn't
+// exact), otherwise the new entry takes an empty slot of the bucket or
+// replaces its least valuable entry (shallow, inexact & from older searches first)
 void TT::store(const board_t *board, move_t move, int score,
-               const int flags, const int depth) {
-    // TODO: Same as in probe, make sure TT is a power of 2
-    size_t idx = board->key % this->size;
-    tt_entry *entry = &table[idx];
+               const int flags, const int depth, const int eval, tt_stats_t *stats) {
+    tt_bucket *bucket = this->bucket(board->key);
 
-    TRACE_TT("Storing " << board->key << " " << idx << " " << move << " "
+    TRACE_TT("Storing " << board->key << " " << (bucket - table) << " " << move << " "
               << score << " " << flags << " " << depth);
 
-    assert(0 <= idx && idx <= this->size - 1);
+    assert(table <= bucket && bucket < table + this->size);
     assert(board->key == generate_pos_key(board));
     assert(depth >= 0);
     assert(BAD <= flags && flags <= EXACT);
 
-    if (entry->key == 0ULL) {
-        ++writes;
-    } else {
-        // TODO: We only store entries if they contain newer information /
-        // better information (higher depth). Otherwise, we don't overwrite
-        // TODO: if (entry->get_age() > this->gen || entry->depth > depth) return;
-        ++overwrites;
+    /* Pick the entry to replace: the entry of the same position if it's
+     * already stored, otherwise an empty entry or the least valuable one */
+    int slot = 0;
+    tt_entry victim;
+    int victim_worth = INT32_MAX;
+    for (int i = 0; i < bucket_size(); ++i) {
+        tt_entry current = read_slot(bucket, i, board->key);
+        if (current.pos_key() == board->key) {
+            slot = i;
+            victim = current;
+            break;
+        }
+        // Empty entries are always the least valuable
+        const int current_worth = current.key == 0ULL ? INT32_MIN : worth(current, gen);
+        if (current_worth < victim_worth) {
+            slot = i;
+            victim = current;
+            victim_worth = current_worth;
+        }
+    }
+
+    // A much deeper entry of the position from the current search is more
+    // valuable than a shallow bound (e.g. of the quiescence search probing
+    // it without a cutoff), it's kept as is
+    if (victim.pos_key() == board->key && flags != EXACT
+        && depth + 3 < victim.depth() && victim.age() == gen) {
+        if (stats) count(stats->kept);
+        return;
+    }
+
+    if (stats) {
+        if (victim.key == 0ULL) {
+            count(stats->writes);
+        } else if (victim.pos_key() == board->key) {
+            count(stats->updates);
+        } else {
+            count(stats->overwrites);
+            count(stats->collisions, victim.age() == gen);
+        }
+        count(stats->bounds[flags]);
+    }
+
+    // Keep the best move of the previous search of the position, if we
+    // don't have one
+    if (move == NULLMV && victim.pos_key() == board->key) {
+        move = victim.move();
     }
 
     // Mate score logic for returning how many plies from mate
@@ -204,22 +967,186 @@ void TT::store(const board_t *board, move_t move, int score,
     // assert(flags == UPPER ? move == NULLMV : move != NULLMV);
 
     /* Finally, store the entry in the transposition table */
-    entry->key   = board->key;
-    entry->depth = static_cast<uint8_t>(depth);
-    entry->flags = static_cast<uint8_t>(flags);
-    // entry->info = static_cast<uint8_t>(((this->gen << 2) & UINT8_MAX) | (flags & 0b11));
-    // entry->age = this->gen;
-    entry->move  = static_cast<uint16_t>(move & UINT16_MAX); // only store the 16 least-significant bits
-    entry->score = static_cast<int32_t>(score);
-
-    TRACE_TT("Stored " << entry->key << " " << idx << " " << entry->move << " "
-              << entry->score << " " << (int)entry->flags << " " << (int)entry->depth);
-
-    // Debug: assert the casts are correct
-    assert(entry->key == board->key);
-    assert(entry->depth == depth);
-    //assert(entry->info >> 2 == this->gen);
-    //assert((entry->info & 0b11) == flags);
-    assert(entry->move == move);
-    assert(entry->score == score);
+    // (only the 16 least-significant bits of the move are stored)
+    uint64_t data = tt_entry::pack(move, score, depth, flags, gen, eval);
+    write_slot(bucket, slot, board->key, data);
+
+    TRACE_TT("Stored " << board->key << " " << slot << " " << (move & UINT16_MAX) << " "
+              << score << " " << flags << " " << depth);
+
+    // Debug: assert the packing is correct
+    #ifdef DEBUG
+    const tt_entry stored{board->key ^ data, data};
+    assert(stored.pos_key() == board->key);
+    assert(stored.depth() == depth);
+    assert(stored.flags() == flags);
+    assert(stored.move() == move);
+    assert(stored.score() == score);
+    assert(stored.age() == gen);
+    assert(stored.eval() == eval);
+    #endif
+}
+
+#ifdef DEBUG
+uint64_t tt_stress_test(int threads_no, int iterations) {
+    // A small table, so that the threads keep overwriting each other's entries
+    TT table;
+    table.resize(1);
+    std::atomic<uint64_t> hits = 0, corrupted = 0;
+
+    auto hammer = [&](uint64_t seed) {
+        board_t board[1];
+        setup(board, start_FEN);
+        tt_entry entry[1];
+        move_t move;
+        int score;
+        uint64_t rng = seed;
+
+        for (int i = 0; i < iterations; ++i) {
+            // Play random moves close to the starting position, so that
+            // all threads keep visiting the same positions
+            random_move(board, rng, 6);
+
+            table.probe(board, entry, move, score, -oo, +oo, 0);
+            if (entry->pos_key() == board->key) {
+                ++hits;
+                if (entry->data != test_data(board->key)) {
+                    ++corrupted;
+                }
+            }
+
+            uint64_t data = test_data(board->key);
+            tt_entry stored{0ULL, data};
+            table.store(board, stored.move(), stored.score(), stored.flags(), stored.depth(),
+                            stored.eval());
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads_no; ++i) {
+        workers.emplace_back(hammer, 0x9e3779b97f4a7c15ULL * (i + 1));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    std::cout << "Threads: " << threads_no << " iterations: " << iterations
+              << " hits: " << hits << " corrupted: " << corrupted << std::endl
+              << (corrupted ? "Failed" : "Passed") << std::endl;
+    return corrupted;
+}
+
+bool tt_large_test(int size_MB) {
+    constexpr int positions_no = 1'000'000;
+    TT table;
+    table.resize(size_MB);
+    std::cout << "Allocated " << table.size_MB() << "MB" << std::endl;
+
+    // Stores entries of random positions (spread all over the table by their
+    // keys), then plays the same moves again and probes the positions
+    uint64_t lost = 0;
+    for (bool storing : {true, false}) {
+        board_t board[1];
+        setup(board, start_FEN);
+        tt_entry entry[1];
+        move_t move;
+        int score;
+        uint64_t rng = 0x9e3779b97f4a7c15ULL;
+        for (int i = 0; i < positions_no; ++i) {
+            random_move(board, rng, 40);
+            if (storing) {
+                tt_entry stored{0ULL, test_data(board->key)};
+                table.store(board, stored.move(), stored.score(), stored.flags(), stored.depth(),
+                            stored.eval());
+            } else {
+                table.probe(board, entry, move, score, -oo, +oo, 0);
+                lost += entry->pos_key() != board->key
+                     || entry->data != test_data(board->key);
+            }
+        }
+    }
+
+    // (only the pages touched by the stores are backed by anything)
+    std::cout << "Backed by " << table.pages_info() << std::endl;
+
+    // At most positions_no entries were stored (the hashfull is sampled,
+    // hence some tolerance)
+    const int hashfull = table.hashfull();
+    const int expected_hashfull = static_cast<int>(
+        positions_no * 1000ULL / (table.size_MB() * BYTES_PER_MB / sizeof(tt_entry)));
+
+    bool passed = table.size_MB() == size_MB && lost == 0 && hashfull <= expected_hashfull + 5;
+    std::cout << "Positions: " << positions_no << " lost: " << lost
+              << " hashfull: " << hashfull << " (at most ~" << expected_hashfull << ")"
+              << std::endl << (passed ? "Passed" : "Failed") << std::endl;
+    return passed;
+}
+
+bool tt_resize_test(int from_MB, int to_MB, bool compact) {
+    TT table;
+    table.set_compact(compact);
+    table.resize(from_MB);
+    // Half as many positions as the smaller table has entries
+    const uint64_t positions_no = std::min(from_MB, to_MB) * BYTES_PER_MB
+                                / sizeof(tt_bucket) * table.bucket_size() / 2;
+
+    // Stores entries of random positions, then plays the same moves again
+    // and probes the positions before & after the resize
+    uint64_t found[2] = {}, corrupted[2] = {};
+    int hashfull[2] = {};
+    for (int pass = 0; pass < 3; ++pass) {
+        if (pass == 2) {
+            hashfull[0] = table.hashfull();
+            constexpr int slices = 4;
+            TT next;
+            table.request_size(to_MB);
+            table.allocate_successor(next);
+            for (int i = 0; i < slices; ++i) {
+                table.migrate(next, i, slices);
+            }
+            table.replace(next);
+            hashfull[1] = table.hashfull();
+        }
+        board_t board[1];
+        setup(board, start_FEN);
+        tt_entry entry[1];
+        move_t move;
+        int score;
+        uint64_t rng = 0x9e3779b97f4a7c15ULL;
+        for (uint64_t i = 0; i < positions_no; ++i) {
+            random_move(board, rng, 40);
+            if (pass == 0) {
+                tt_entry stored{0ULL, test_data(board->key)};
+                table.store(board, stored.move(), stored.score(), stored.flags(), stored.depth(),
+                            stored.eval());
+                continue;
+            }
+            table.probe(board, entry, move, score, -oo, +oo, 0);
+            if (entry->pos_key() == board->key) {
+                ++found[pass - 1];
+                // (compact entries don't store the static evaluation)
+                corrupted[pass - 1] += ((entry->data ^ test_data(board->key)) & 0xffffffffffffULL) != 0;
+            }
+        }
+    }
+
+    // Compact entries get matched by other positions sharing the 16 bits of
+    // the key they store now and then
+    const uint64_t false_matches = compact ? positions_no * table.bucket_size() >> 16 : 0;
+    // In a table a multiple of the size, a bucket's entries all come from
+    // a single bucket of the old one, hence they all fit (compact entries
+    // don't store enough of the key to be migrated into a grown table)
+    const bool lossless = to_MB % from_MB == 0 && !compact;
+    // A grown table can't be any fuller than the old one
+    const bool grown = to_MB >= from_MB;
+    bool passed = table.size_MB() == to_MB
+               && corrupted[0] <= false_matches && corrupted[1] <= false_matches
+               && (!lossless || found[1] >= found[0])
+               && (!grown || hashfull[1] <= hashfull[0]);
+    std::cout << "Positions: " << positions_no << " found before: " << found[0]
+              << " (corrupted " << corrupted[0] << ") after: " << found[1]
+              << " (corrupted " << corrupted[1] << ") hashfull before: " << hashfull[0]
+              << " after: " << hashfull[1] << std::endl << (passed ? "Passed" : "Failed") << std::endl;
+    return passed;
 }
+#endif // DEBUG
@@ -19,6 +19,9 @@
 #ifndef TRANSPOSITION_H_
 #define TRANSPOSITION_H_
 
+#include <string>
+#include <ostream>
+
 #include "types.h"
 #include "board.h"
 
@@ -31,69 +34,381 @@ enum { BAD = 0, UPPER = 1, LOWER = 2, EXACT = LOWER | UPPER };
 
 enum { TTMISS = 0, TTHIT = 1 };
 
-// 64+8+8+16+32=128bits for better cache performance
+// Bytes in a MB (sizes are computed in 64-bit arithmetic, tables can be huge)
+constexpr size_t BYTES_PER_MB = 0x100000;
+
+// Kind of memory pages backing the transposition table
+// - REGULAR_PAGES: Regular (4KB) pages
+// - TRANSPARENT_HUGE_PAGES: Huge pages requested from the kernel (madvise),
+//   which backs the table by them when it can (see TT::pages_info())
+// - HUGETLB_PAGES: Huge pages reserved in the kernel's huge page pool
+enum { REGULAR_PAGES = 0, TRANSPARENT_HUGE_PAGES = 1, HUGETLB_PAGES = 2 };
+
+// Static evaluation of entries which don't store one
+constexpr int NO_EVAL = INT16_MIN;
+
+// Number of generations the age of the entries wraps around after
+constexpr int GENERATIONS = 64;
+
+// Kind of nodes probing the table, as told by their search window
+// - PV_NODE: Open window, the node may end up on the principal variation
+// - NON_PV_NODE: Null window
+enum { PV_NODE = 0, NON_PV_NODE = 1, NODE_TYPES = 2 };
+
+// Probe statistics for a given depth & node type
+typedef struct tt_probe_stats_t {
+    uint64_t probes = 0; // Probes of the table
+    uint64_t found = 0;  // Probes finding their position
+    uint64_t hits = 0;   // Probes finding an entry searched deep enough
+    uint64_t cuts = 0;   // Probes returning a score usable for a cutoff
+} tt_probe_stats_t;
+
+// Statistics of a search thread's use of the table. Every thread counts into
+// its own (see thread_t in threads.h), so the threads don't share counters,
+// and the main thread reads them with relaxed atomics while they're counting
+typedef struct tt_stats_t {
+    // (64-bit, since tables with over 4G entries are allowed)
+    uint64_t writes = 0;     // Stores into empty entries
+    uint64_t updates = 0;    // Stores replacing an entry of the same position
+    uint64_t overwrites = 0; // Stores replacing an entry of another position
+    uint64_t collisions = 0; // Overwrites of entries of the current search
+    uint64_t kept = 0;       // Stores not replacing a much deeper entry of the position
+    uint64_t bounds[EXACT + 1] = {}; // Stores by bound type
+    // Probes by depth (0 in the quiescence search) & node type
+    tt_probe_stats_t probes[MAX_DEPTH][NODE_TYPES] = {};
+
+    // Resets the statistics (by the counting thread)
+    void clear();
+    // Adds the statistics of another (possibly counting) thread
+    void add(const tt_stats_t &other);
+    // Returns the number of probes & of probes finding their position
+    uint64_t probes_no() const;
+    uint64_t found_no() const;
+} tt_stats_t;
+
+// 64+64=128bits for better cache performance
 // (nicely aligned with 64-byte cache lines (4 entries)
+// The entry is stored as two 64-bit words: the data word packing the move,
+// score, depth, flags, age and static evaluation, and the Zobrist key XOR-ed
+// with the data word.
+// A probe only trusts the entry if key ^ data gives back the position's key,
+// so an entry torn by concurrent writes from another thread is a simple miss
+// and the table needs no locks (lockless hashing, see
+// https://www.chessprogramming.org/Shared_Hash_Table#Lockless)
 typedef struct alignas(16) tt_entry {
-    // The Zobrist hash key of the stored node
+    // The Zobrist hash key of the stored node XOR-ed with the data
     uint64_t key = 0ULL;
-    // Depth the position was searched to
-    uint8_t depth = 0;
-    // Type of entry (flag) + age
-    // We use the two lsb for the hash entry flag and the rest for age
-    //uint8_t info = BAD;
-    uint8_t flags = BAD;
-    uint8_t age = 0;
-    // Best move in the current node
-    uint16_t move = NULLMV;
-    // Stored value in this node (either exact or lower/upperbound)
-    int32_t score = 0;
+    // Bits  0-15: best move in the current node
+    // Bits 16-31: stored value in this node (either exact or lower/upperbound)
+    // Bits 32-39: depth the position was searched to
+    // Bits 40-41: type of entry (flag)
+    // Bits 42-47: age (the generation of the search storing the entry)
+    // Bits 48-63: static evaluation of the position
+    uint64_t data = 0ULL;
+
     // Helpers
-    //uint8_t get_flag() const {
-        //return info & 0b11;
-    //}
-    //uint8_t get_age() const {
-        //return (info >> 2) & 0b111111;
-    //}
+    move_t move() const {
+        return static_cast<move_t>(data & 0xffff);
+    }
+    int score() const {
+        return static_cast<int16_t>((data >> 16) & 0xffff);
+    }
+    int depth() const {
+        return static_cast<int>((data >> 32) & 0xff);
+    }
+    int flags() const {
+        return static_cast<int>((data >> 40) & 0x3);
+    }
+    int age() const {
+        return static_cast<int>((data >> 42) & 0x3f);
+    }
+    int eval() const {
+        return static_cast<int16_t>((data >> 48) & 0xffff);
+    }
+    // Zobrist key of the position stored in the entry
+    uint64_t pos_key() const {
+        return key ^ data;
+    }
+
+    // Packs the entry's fields into a data word
+    static uint64_t pack(move_t move, int score, int depth, int flags, int age,
+                         int eval) {
+        return (static_cast<uint64_t>(move & 0xffff))
+             | (static_cast<uint64_t>(static_cast<uint16_t>(score)) << 16)
+             | (static_cast<uint64_t>(depth & 0xff) << 32)
+             | (static_cast<uint64_t>(flags & 0x3)  << 40)
+             | (static_cast<uint64_t>(age & 0x3f)   << 42)
+             | (static_cast<uint64_t>(static_cast<uint16_t>(eval)) << 48);
+    }
 } tt_entry;
 
+static_assert(sizeof(tt_entry) == 16, "TT entries should be 128 bits");
+// The generation of the table is compared with the entries' ages, hence it
+// must wrap around exactly when the 6-bit age does (in both layouts)
+static_assert(GENERATIONS == 0x3f + 1, "The age of the entries should wrap around with the generation");
+
+// Number of entries in a bucket
+constexpr int BUCKET_SIZE = 4;
+// Number of compact entries in a bucket
+constexpr int COMPACT_BUCKET_SIZE = 8;
+
+// The entries are clustered into buckets the size of a cache line: a position
+// can be stored in any entry of its bucket, so a probe fetches a single
+// cache line and scans all of its entries.
+// With the compact layout, the bucket's words hold 8 compact entries instead.
+// A compact entry is a single 64-bit word (hence it can't be torn) storing only
+// the 16 least-significant bits of the Zobrist key, since the bucket index
+// already encodes the most-significant bits, and no static evaluation:
+// Bits  0-15: key, 16-31: move, 32-47: score, 48-55: depth, 56-57: flags,
+// 58-63: age
+typedef struct alignas(64) tt_bucket {
+    tt_entry entries[BUCKET_SIZE];
+} tt_bucket;
+
+static_assert(sizeof(tt_bucket) == 64, "TT buckets should fill a cache line");
+
+// Header of a transposition table saved to a file (or shared between
+// processes), followed by the buckets. A saved (shared) table is only usable
+// by an engine using the same entry layout and the same Zobrist keys
+typedef struct alignas(64) tt_file_header {
+    char magic[8] = {'L', 'S', 'X', 'H', 'A', 'S', 'H', '\0'};
+    uint32_t entry_size = sizeof(tt_entry); // 8 with the compact layout
+    uint32_t bucket_size = BUCKET_SIZE;
+    // Number of buckets in the table
+    uint64_t buckets = 0;
+    // Seed of the Zobrist keys & the key of the starting position
+    // (to detect keys generated differently from the same seed)
+    uint64_t zobrist_seed = ZOBRIST_SEED;
+    uint64_t start_key = 0ULL;
+    // Age of the table when it was saved
+    uint32_t gen = 0;
+    // Version of the entry layout
+    uint32_t version = 3;
+    // Number of processes attached to a shared table (0 in a file)
+    uint32_t attached = 0;
+    // Evaluator of the static evaluations stored in the entries
+    // (see TT::set_eval_source())
+    uint32_t eval_source = 0;
+} tt_file_header;
+
+static_assert(sizeof(tt_file_header) == sizeof(tt_bucket),
+              "The buckets of a saved table should stay aligned to cache lines");
+
 
 class TT {
   public:
     // Constructor & Destructor
+    // (the table is only allocated once it's needed, see allocate_tt())
     TT(const int MB = 128);
     ~TT();
     // Resizes the transposition table
     void resize(const int new_size_MB);
+    // Sets the size of the table, which gets (re)allocated lazily
+    inline void request_size(const int new_size_MB) {
+        this->pending_MB = new_size_MB;
+    }
+    // Makes the table be loaded from a file on its next (re)allocation
+    inline void request_file(const std::string &path) {
+        this->pending_file = path;
+        this->pending_MB = size_MB();
+    }
+    // Returns whether the table is yet to be (re)allocated
+    inline bool resize_pending() const {
+        return this->pending_MB != 0;
+    }
+    // Returns whether the table's entries can be migrated into the table of
+    // the pending size (the table is neither replaced by a saved or a shared
+    // one nor by one of another layout or evaluator)
+    bool migratable() const;
+    // Allocates the (zeroed) table of the pending size the entries of this
+    // one get migrated into, returns false on failure
+    bool allocate_successor(TT &next) const;
+    // Migrates the entries indexing into the i-th out of n equally sized
+    // slices of the successor's buckets, keeping the most valuable (deepest)
+    // entries when they don't fit. The slices can be migrated in parallel:
+    // the slices of the old table they read from only overlap at the edges
+    void migrate(TT &next, size_t i, size_t n) const;
+    // Replaces the table by its successor (once the entries are migrated)
+    void replace(TT &next);
+    // Makes the table be shared with other processes via the named POSIX
+    // shared memory segment (private if the name is empty), from its next
+    // (re)allocation on
+    inline void request_shared(const std::string &name) {
+        this->shared_name = name;
+        this->pending_MB = size_MB();
+    }
+    // Returns the name of the shared memory segment backing the table
+    // (requested, empty if the table should be private)
+    inline const std::string &shared_segment() const {
+        return this->shared_name;
+    }
+    // Returns whether the table is attached to a shared memory segment
+    inline bool shared() const {
+        return this->shared_header != nullptr;
+    }
+    // Returns the number of processes attached to the shared table
+    uint32_t attached_no() const;
+    // Returns the file requested to be loaded (empty if none) & resets it
+    inline std::string take_pending_file() {
+        std::string path;
+        path.swap(this->pending_file);
+        return path;
+    }
+    // Saves the table to a file, returns false on failure
+    bool save(const std::string &path) const;
+    // Maps the table saved in a file into memory (copy-on-write, i.e.
+    // the file isn't modified), returns false on failure
+    bool load(const std::string &path);
+    // Attaches the table to the shared memory segment of the given name,
+    // creating it if it doesn't exist yet, returns false on failure.
+    // The process creating the segment sizes it (by the requested size &
+    // layout), the processes attaching later adopt its size but must use
+    // the same layout. The segment is removed once the last process
+    // detaches (on a resize or on exit). A stale segment, whose creator died
+    // before publishing its header, is removed & created anew if recreate is set
+    bool attach(const std::string &name, bool recreate = true);
     // Clears the transposition table
     void clear();
-    // Resets the statistics
-    void reset_stats();
+    // Clears the i-th out of n equally sized slices of the table
+    void clear(size_t i, size_t n);
+    // Prints the statistics (of the search threads, see tt_stats_searched()
+    // in threads.h) as info strings: probe & hit rates by depth & node type,
+    // stores by outcome & bound type and the occupancy of (a sample of) the
+    // table by generation
+    void print_stats(std::ostream &out, const tt_stats_t &stats) const;
     // Probes the transposition table for a move and a score
-    int probe(const board_t*, tt_entry*, move_t&, int &score, int alpha, int beta, int depth);
+    // (counted in the statistics, if given)
+    int probe(const board_t*, tt_entry*, move_t&, int &score, int alpha, int beta, int depth,
+              tt_stats_t *stats = nullptr);
     // Stores an entry in our transposition table
+    // (counted in the statistics, if given)
     void store(const board_t *board, move_t move, int score,
-               const int flags, const int depth);
-    // Returns the hashfull info in permilles
-    inline int hashfull() const {
-        return writes * 1000 / size;
+               const int flags, const int depth, const int eval = NO_EVAL,
+               tt_stats_t *stats = nullptr);
+    // Returns the size of the table in MB
+    inline int size_MB() const {
+        return pending_MB ? pending_MB : static_cast<int>(size * sizeof(tt_bucket) / BYTES_PER_MB);
+    }
+    // Returns the hashfull info in permilles: the share of the entries of
+    // the current search in (a sample of) the table (of all the entries
+    // in a shared table, which isn't aged)
+    int hashfull() const;
+    // Ages the table by one generation (at the start of every search), so that
+    // entries of the previous searches get replaced first
+    // (a shared table isn't aged: the attached processes search independently)
+    void age();
+    // Sets whether to try backing the table by huge pages (from the next
+    // resize on) and returns the previous setting
+    bool set_huge_pages(bool enabled);
+    // Returns a description of the pages backing the table. Transparent huge
+    // pages are only reported if the kernel actually backs (the touched part
+    // of) the table by them
+    std::string pages_info() const;
+    // Sets whether to use the compact entry layout (the table gets
+    // reallocated lazily) and returns the previous setting
+    inline bool set_compact(bool enabled) {
+        bool previous = this->compact;
+        this->compact = enabled;
+        this->pending_MB = size_MB();
+        return previous;
+    }
+    // Sets the evaluator whose static evaluations the entries store (0 for
+    // the classical evaluation, the network's id for NNUE, see nnue_id()).
+    // The evaluations of another evaluator mustn't be reused, hence changing
+    // it makes the table be reallocated (cleared) lazily, and saved & shared
+    // tables are only usable by the same evaluator
+    inline void set_eval_source(uint32_t source) {
+        if (source != this->eval_source) {
+            this->eval_source = source;
+            this->pending_MB = size_MB();
+        }
+    }
+    // Returns the number of entries in a bucket
+    inline int bucket_size() const {
+        return compact ? COMPACT_BUCKET_SIZE : BUCKET_SIZE;
+    }
+    // Prefetches the bucket of a position into the cache
+    inline void prefetch(uint64_t key) const {
+        __builtin_prefetch(bucket(key));
     }
-    // Ages the table by one generation
-    // inline void age() {
-        // this->gen++;
-    // }
 
   private:
-    tt_entry *table = nullptr;
-    size_t size = 0;
-    // unsigned gen = 0; // Current age of most recent search's entries
-    /* Statistics */
-    unsigned writes = 0;
-    unsigned overwrites = 0;
-    unsigned hit = 0;
-    unsigned cut = 0;
+    // Returns the bucket a position with the given key is stored in:
+    // the high 64 bits of key * size map the key uniformly onto [0, size)
+    // for any table size, without the division of key % size
+    inline tt_bucket *bucket(uint64_t key) const {
+        __extension__ using uint128_t = unsigned __int128;
+        return &table[(static_cast<uint128_t>(key) * size) >> 64];
+    }
+
+    // Reads the i-th entry of a bucket in its full form (compact entries are
+    // completed by the bits of key the bucket index is derived from)
+    tt_entry read_slot(tt_bucket *bucket, int i, uint64_t key) const;
+    // Writes an entry of a position with the given key & data to a bucket
+    void write_slot(tt_bucket *bucket, int i, uint64_t key, uint64_t data);
+    // Places a migrated entry of a position with the given key into a bucket,
+    // unless all the entries in the bucket are more valuable
+    void place(tt_bucket *bucket, uint64_t key, const tt_entry &entry);
+
+    // Allocates a zeroed table of size buckets, returns false on failure
+    bool allocate();
+    // Releases the table's memory
+    void deallocate();
+
+    // Allocated memory, the table is aligned to a cache line within it
+    void *memory = nullptr;
+    tt_bucket *table = nullptr;
+    size_t size = 0; // Number of buckets
+    int pending_MB = 0; // Requested size (in MB) of a table yet to be allocated
+    std::string pending_file; // File to load the table from on its allocation
+    size_t mapped = 0; // Number of mmap-ed bytes (0 if allocated on the heap)
+    std::string shared_name; // Shared memory segment requested to back the table
+    std::string attached_name; // Shared memory segment the table is attached to
+    tt_file_header *shared_header = nullptr; // Header of the attached segment
+    int pages = REGULAR_PAGES;
+    bool huge_pages = true; // Whether to try allocating huge pages
+    bool compact = false; // Whether the entries use the compact layout
+    bool table_compact = false; // Whether the allocated table's entries do
+    uint32_t eval_source = 0; // Evaluator of the entries' static evaluations
+    uint32_t table_eval_source = 0; // Evaluator of the allocated table's ones
+    uint8_t gen = 0; // Current age of most recent search's entries (< GENERATIONS)
 };
 
 // Global transposition table in transposition.cpp
 extern TT tt;
 
+// Tests of the transposition table (debug builds only, see tests/tt_test.sh)
+#ifdef DEBUG
+/**
+ @brief Stress tests the lockless transposition table: many threads store
+ and probe entries of the same positions concurrently, and every hit whose
+ contents don't match the position they were stored for is counted as corrupted
+ @param threads_no number of threads hammering the table
+ @param iterations number of random moves played by each thread
+ @returns the number of corrupted hits
+ */
+uint64_t tt_stress_test(int threads_no, int iterations);
+
+/**
+ @brief Allocates a large table (without clearing it, the fresh memory is
+ zeroed and only the touched pages get committed), checks its size, stores
+ and probes positions all over it and checks the hashfull
+ @param size_MB size of the table in MB
+ @returns true if the test passed
+ */
+bool tt_large_test(int size_MB);
+
+/**
+ @brief Fills a table with positions, resizes it (migrating its entries in
+ slices, as in allocate_tt()) and checks that the entries found afterwards
+ are intact, when growing the table by a whole factor, that none of them
+ got lost (unless compact), and when growing it, that it's no fuller than before
+ @param from_MB size of the table in MB before the resize
+ @param to_MB size of the table in MB after the resize
+ @param compact whether to use the compact entry layout
+ @returns true if the test passed
+ */
+bool tt_resize_test(int from_MB, int to_MB, bool compact);
+#endif // DEBUG
+
 #endif // TRANSPOSITION_H_
@@ -366,6 +366,23 @@ using bb_t = uint64_t;
 
 constexpr int oo = 30'000; // INF
 
+// A middle game & an endgame score packed into one integer (the endgame
+// score in the upper half), so that the evaluation terms are added up at once
+using score_t = int32_t;
+
+constexpr score_t S(const int mg, const int eg) {
+    return static_cast<score_t>(static_cast<uint32_t>(eg) << 16) + mg;
+}
+
+inline int mg_value(const score_t s) {
+    return static_cast<int16_t>(static_cast<uint16_t>(static_cast<uint32_t>(s)));
+}
+
+// (the middle game score is sign-extended, hence the rounding)
+inline int eg_value(const score_t s) {
+    return static_cast<int16_t>(static_cast<uint16_t>((static_cast<uint32_t>(s) + 0x8000) >> 16));
+}
+
 // Castling rights encoding (4 bits)
 enum { WK = 0b0001, WQ = 0b0010, BK = 0b0100, BQ = 0b1000 };
 
@@ -404,7 +421,9 @@ typedef struct searchinfo_t {
     uint64_t inc;
     uint64_t start;
     uint64_t end;
-    uint64_t nodes = 0ULL;
+    // Only the searching thread writes its node count, the main thread reads
+    // the counts of all the threads (see nodes_searched() in threads.h)
+    std::atomic<uint64_t> nodes = 0ULL;
     // For testing move ordering
     uint64_t fail_high_first = 0ULL;
     uint64_t fail_high = 0ULL;
@@ -417,10 +436,19 @@ typedef struct searchinfo_t {
     bool quit = false;
     bool stopped = false;
     bool time_set = false;
+    // Counts a visited node (a relaxed load & store, the thread's counter
+    // has no other writers, hence no locked increment is needed)
+    inline void count_node() {
+        nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    // Returns the number of nodes visited so far
+    inline uint64_t nodes_no() const {
+        return nodes.load(std::memory_order_relaxed);
+    }
     // Helper for clearing necessary struct info before searching
     inline void clear() {
         stopped = false;
-        nodes = 0ULL;
+        nodes.store(0ULL, std::memory_order_relaxed);
         fail_high_first = 0ULL;
         fail_high = 0ULL;
         nullcut = 0ULL;
@@ -432,13 +460,15 @@ typedef struct searchinfo_t {
 } searchinfo_t;
 
 // An element of the search stack
-// TODO: For LazySMP, each thread needs its own PV, eval, etc.
-// TT is global & shared between the threads
+// (each search thread keeps its own stack, see thread_t in threads.h)
 typedef struct stack_t {
     move_t killer[2] = {};
     int32_t score = 0;
 } stack_t;
 
+// History heuristic, table indexed by [stm][piece][to square]
+using history_t = int32_t[BOTH][PIECE_NO][SQUARE_NO];
+
 // Useful test positions
 const std::string start_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 const std::string kiwipete_FEN = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
@@ -36,10 +36,20 @@
 /* Options need to be non-static, since they influence
  * other parts of the engine (like search) */
 option_t options[] = {
-        {"Hash", OPT_TYPE::SPIN, 0, 128, 2047, -1},
+        {"Hash", OPT_TYPE::SPIN, 1, 128, 33554432, -1}, // Up to 32TB
 //TODO: {"Ponder", OPT_TYPE::CHECK, 0, 0, 1, -1},
         {"Move Safety Overhead", OPT_TYPE::SPIN, 0, 10, 50, -1},
-        {"Threads", OPT_TYPE::SPIN, 1, 1, 1, -1},
+        {"Threads", OPT_TYPE::SPIN, 1, 1, 256, -1},
+        {"NUMA Pinning", OPT_TYPE::CHECK, 0, 0, 1, -1},
+        {"Compact Hash", OPT_TYPE::CHECK, 0, 0, 1, -1},
+        {"Hash File", OPT_TYPE::STRING, 0, 0, 0, -1},
+        {"Save Hash File", OPT_TYPE::BUTTON, 0, 0, 0, -1},
+        {"Hash Stats Interval", OPT_TYPE::SPIN, 0, 0, 3600000, -1},
+        {"Shared Hash", OPT_TYPE::STRING, 0, 0, 0, -1},
+        {"Use NNUE", OPT_TYPE::CHECK, 0, 0, 1, -1},
+        {"EvalFile", OPT_TYPE::STRING, 0, 0, 0, -1},
+        {"NNUE Kernel", OPT_TYPE::COMBO, 0, 0, 0, -1, "auto", {"auto", "avx2", "sse", "scalar"}},
+        {"Lazy Eval Margin", OPT_TYPE::SPIN, 0, LAZY_MARGIN, 2000, -1},
 //TODO: {"Use Book", OPT_TYPE::CHECK, 0, 0, 0, -1},
 //TODO: {"Book path", OPT_TYPE::STRING, 0, 0, 0, -1},
 };
@@ -65,9 +75,15 @@ void print_options() {
                 std::cout << " default " << opt.def
                     << " min " << opt.min
                     << " max " << opt.max; break;
+            case OPT_TYPE::STRING:
+                std::cout << " default <empty>"; break;
             case OPT_TYPE::COMBO:
+                std::cout << " default " << opt.str;
+                for (const std::string &var : opt.vars) {
+                    std::cout << " var " << var;
+                }
+                break;
             case OPT_TYPE::BUTTON:
-            case OPT_TYPE::STRING:
                 //TODO:
                 break;
         }
@@ -75,15 +91,88 @@ void print_options() {
     }
 }
 
+// Returns the value of a string option
+std::string option_str(const std::string &name) {
+    for (const option_t& opt : options) {
+        if (opt.name == name) return opt.str;
+    }
+    return "";
+}
+
+// Saves the transposition table to a file, so that it can be loaded
+// (via the Hash File option) after the engine restarts. Waits for the search
+// to finish first, and saves the table as (re)allocated with the current options
+void save_hash(const std::string &path) {
+    if (path.empty() || path == "<empty>") {
+        std::cout << "info string No hash file set" << std::endl;
+        return;
+    }
+    search_wait();
+    allocate_tt();
+    if (tt.save(path)) {
+        std::cout << "info string Hash saved to " << path << std::endl;
+    } else {
+        std::cout << "info string Cannot save the hash to " << path << std::endl;
+    }
+}
+
 // TODO: onChangedHandler
-void set_option(std::string name, int value) {
+void set_option(std::string name, int value, const std::string &str) {
     std::cout << "Setting option " << name << " to " << value << std::endl;
-    for (auto opt : options) {
+    for (auto& opt : options) {
         if (opt.name != name) continue;
 
         opt.value = value;
+        opt.str = str;
         // Temporary, need to improve this
-        if (name == "Hash") tt.resize(MIN(opt.max, value));
+        if (name == "Hash") tt.request_size(MIN(opt.max, value));
+        if (name == "Threads") set_threads(MIN(opt.max, value));
+        if (name == "Compact Hash") tt.set_compact(value);
+        if (name == "NUMA Pinning") {
+            set_numa_pinning(value);
+            // Reallocate the table, so that its pages get placed
+            // on the nodes of the (re)pinned threads
+            tt.request_size(tt.size_MB());
+        }
+        // The saved table gets mapped (rather than allocated) lazily
+        if (name == "Hash File" && !str.empty() && str != "<empty>") {
+            tt.request_file(str);
+        }
+        if (name == "Save Hash File") {
+            save_hash(option_str("Hash File"));
+        }
+        if (name == "Hash Stats Interval") set_tt_stats_interval(value);
+        if (name == "Lazy Eval Margin") set_lazy_margin(value);
+        // Processes using the same name share their table (POSIX shared
+        // memory object names start with a slash)
+        if (name == "Shared Hash") {
+            if (str.empty() || str == "<empty>") tt.request_shared("");
+            else tt.request_shared(str[0] == '/' ? str : "/" + str);
+        }
+        if (name == "Use NNUE") {
+            nnue_use(value);
+            if (value && !nnue_loaded()) {
+                std::cout << "info string No network loaded (set EvalFile)" << std::endl;
+            }
+        }
+        if (name == "EvalFile" && !str.empty() && str != "<empty>") {
+            if (nnue_load(str)) {
+                std::cout << "info string Network loaded from " << str << std::endl;
+            } else {
+                std::cout << "info string Cannot load a network from " << str << std::endl;
+            }
+        }
+        if (name == "NNUE Kernel" && !nnue_set_kernel(str)) {
+            nnue_set_kernel("auto");
+            std::cout << "info string Kernel " << str << " not supported, using "
+                      << nnue_kernel_name(nnue_kernel()) << std::endl;
+        }
+        // Evaluations of the other evaluator are no longer valid, neither
+        // cached nor stored in the TT (which gets cleared lazily)
+        if (name == "Use NNUE" || name == "EvalFile") {
+            run_on_threads([](thread_t *thread) { thread->eval_cache.clear(); });
+            tt.set_eval_source(nnue_active() ? nnue_id() : 0);
+        }
     }
 }
 
@@ -195,11 +284,11 @@ void parse_go(board_t *board, searchinfo_t *info, std::istringstream &iss) {
 }
 
 // Forward declarations (needed because the functions are static and mutually recursive)
-void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &search_thread, board_t *board);
-void process_file(const std::string &filename, searchinfo_t *info, std::thread &search_thread, board_t *board);
+void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, board_t *board);
+void process_file(const std::string &filename, searchinfo_t *info, board_t *board);
 
 // Processes a single UCI command
-void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &search_thread, board_t *board) {
+void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, board_t *board) {
     std::string token;
     iss >> std::skipws >> token;
     if (token == "uci") {
@@ -208,12 +297,16 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
         print_options();
         std::cout << "uciok" << std::endl;
     } else if (token == "isready")  {
+        allocate_tt();
         std::cout << "readyok" << std::endl;
     } else if (token == "ucinewgame") {
-        tt.clear();
+        // A table yet to be allocated gets cleared once it's allocated
+        // (a shared table is never cleared, the other processes might be
+        // using its entries, which just age out instead)
+        if (!tt.resize_pending() && !tt.shared()) clear_tt();
         parse_position(board, "position startpos\n");
     } else if (token == "stop") {
-        search_stop(search_thread, info);
+        search_stop(info);
     } else if (token == "quit") {
         info->quit = true;
         info->state = ENGINE_QUIT;
@@ -253,11 +346,21 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
         std::string opt_name = "";
         std::string tmp;
         int opt_val = 0;
-        iss >> opt_name; // skips the "name" token
-        iss >> opt_name; // TODO: Options can have whitespaces in them
-        iss >> tmp; // skips the "value" token
-        iss >> opt_val;
-        set_option(opt_name, opt_val);
+        iss >> tmp; // skips the "name" token
+        // Option names can have whitespaces in them
+        while (iss >> tmp && tmp != "value") {
+            opt_name += (opt_name.empty() ? "" : " ") + tmp;
+        }
+        // String values (e.g. paths) can have whitespaces in them too
+        tmp.clear();
+        std::getline(iss >> std::ws, tmp);
+        // Check options are set to "true" or "false"
+        opt_val = (tmp == "true") ? 1 : std::atoi(tmp.c_str());
+        set_option(opt_name, opt_val, tmp);
+        // The accumulators only get updated while the network is in use
+        if (nnue_active()) {
+            nnue_refresh(board, &board->accumulator);
+        }
     } else if (token == "perft") {
         // Get user argument
         std::string depth_str;
@@ -310,45 +413,108 @@ void process_uci_cmd(std::istringstream &iss, searchinfo_t *info, std::thread &s
         parse_position(board, position_str);
     } else if (token == "go"){
         // Stop any ongoing search
-        search_stop(search_thread, info);
+        search_stop(info);
         // Parse the go, populating the info struct with search requirements
         parse_go(board, info, iss);
         LOG("Starting search with depth " << info->depth << " time " << info->time
                                         << " inc " << info->inc);
         // search(board, info);
-        search_start(search_thread, board, info);
+        search_start(board, info);
     } else if (token == "eval") {
         eval_t eval[1];
-        evaluate(board, eval);
-        eval->print();
+        int score = evaluate(board, eval);
+        if (nnue_active()) {
+            std::cout << "NNUE (" << nnue_kernel_name(nnue_kernel()) << ") score: "
+                      << score << std::endl;
+        } else {
+            eval->print();
+        }
     } else if (token == "dumphistory") {
         std::cout << "White:\n";
         for (piece_t p = NO_PIECE; p < PIECE_NO; ++p) {
             for (square_t sq = A1; sq <= H8; ++sq) {
                 std::cout << piece_to_ascii[p] << " to " << square_to_str(sq) \
-                        << ": " << board->history_h[WHITE][p][sq] << std::endl;
+                        << ": " << threads[0]->history_h[WHITE][p][sq] << std::endl;
             }
         }
         std::cout << "Black:\n";
         for (piece_t p = NO_PIECE; p < PIECE_NO; ++p) {
             for (square_t sq = A1; sq <= H8; ++sq) {
                 std::cout << piece_to_ascii[p] << " to " << square_to_str(sq) \
-                        << ": " << board->history_h[BLACK][p][sq] << std::endl;
+                        << ": " << threads[0]->history_h[BLACK][p][sq] << std::endl;
             }
         }
     } else if (token == "execute") {
         std::string filename;
         iss >> filename;
-        process_file(filename, info, search_thread, board);
+        process_file(filename, info, board);
     } else if (token == "bench") {
-        bench(search_thread, board, info);
+        std::string mode;
+        iss >> mode;
+        if (mode == "numa") {
+            bench_numa(board, info);
+        } else if (mode == "hugepages") {
+            bench_huge_pages(board, info);
+        } else if (mode == "compact") {
+            bench_compact(board, info);
+        } else if (mode == "evalcache") {
+            bench_eval_cache(board, info);
+        } else if (mode == "nnue") {
+            bench_nnue(board, info);
+        } else if (mode == "lazy") {
+            bench_lazy_eval(board, info);
+        } else {
+            bench(board, info);
+        }
+    } else if (token == "savehash") {
+        // savehash [file] (defaults to the Hash File option)
+        std::string path;
+        iss >> path;
+        save_hash(path.empty() ? option_str("Hash File") : path);
+    } else if (token == "loadhash") {
+        // loadhash <file>
+        std::string path;
+        iss >> path;
+        search_wait();
+        tt.request_file(path);
+        allocate_tt();
+    } else if (token == "ttstats") {
+        // Statistics of the last (or current) search
+        tt.print_stats(std::cout, tt_stats_searched());
+#ifdef DEBUG
+    // Transposition table & network tests (see tests/tt_test.sh)
+    } else if (token == "ttresize") {
+        // ttresize [from MB] [to MB] [compact]
+        std::string from_str, to_str, layout;
+        iss >> from_str >> to_str >> layout;
+        tt_resize_test(from_str.empty() ? 16 : std::atoi(from_str.c_str()),
+                       to_str.empty() ? 64 : std::atoi(to_str.c_str()),
+                       layout == "compact");
+    } else if (token == "ttlarge") {
+        // ttlarge [MB]
+        std::string size_str;
+        iss >> size_str;
+        tt_large_test(size_str.empty() ? 4096 : std::atoi(size_str.c_str()));
+    } else if (token == "nnuetest") {
+        // nnuetest [file to round-trip a random network through]
+        std::string path;
+        iss >> path;
+        nnue_test(path);
+    } else if (token == "ttstress") {
+        // ttstress [threads] [iterations]
+        std::string threads_str, iterations_str;
+        iss >> threads_str >> iterations_str;
+        int threads_no = threads_str.empty() ? 8 : std::atoi(threads_str.c_str());
+        int iterations = iterations_str.empty() ? 1'000'000 : std::atoi(iterations_str.c_str());
+        tt_stress_test(threads_no, iterations);
+#endif
     } else {
         std::cout << "Unknown command: '" << token << "'" << std::endl;
     }
 }
 
 // Processes a file of UCI commands line-by-line
-void process_file(const std::string &filename, searchinfo_t *info, std::thread &search_thread, board_t *board) {
+void process_file(const std::string &filename, searchinfo_t *info, board_t *board) {
     std::ifstream file(filename);
 
     if (!file.is_open()) {
@@ -360,7 +526,7 @@ void process_file(const std::string &filename, searchinfo_t *info, std::thread &
     while (std::getline(file, line)) {
         std::cout << "<< " << line << std::endl;
         std::istringstream iss(line);
-        process_uci_cmd(iss, info, search_thread, board);
+        process_uci_cmd(iss, info, board);
         // Block until executed
         while (info->state == ENGINE_SEARCHING) {};
     }
@@ -378,8 +544,8 @@ void loop(int argc, char* argv[]) {
 
     searchinfo_t info[1];
 
-    // Thread used for searching, the main thread will handle the UCI loop
-    std::thread search_thread;
+    // The search is performed by the thread pool (see threads.h),
+    // the main thread will handle the UCI loop
 
     // Initially the engine isn't searching anything
     info->state = ENGINE_STOPPED;
@@ -397,13 +563,11 @@ void loop(int argc, char* argv[]) {
             input = "quit";
 
         std::istringstream iss(input);
-        process_uci_cmd(iss, info, search_thread, board);
+        process_uci_cmd(iss, info, board);
     } while (!info->quit && argc == 1);
 
-    // Make sure the search thread was joined before exiting
-    if (search_thread.joinable()) {
-        search_thread.join();
-    }
+    // Make sure the search threads are done before exiting
+    search_wait();
 
     LOG("Quitting the UCI loop...");
 }
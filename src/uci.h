@@ -20,6 +20,7 @@
 #define UCI_H_
 
 #include <string>
+#include <vector>
 #include "board.h"
 #include "movegen.h"
 
@@ -32,6 +33,8 @@ typedef struct option_t {
     OPT_TYPE type;
     int min, def, max;
     int value;
+    std::string str = ""; // Value of string & combo options
+    std::vector<std::string> vars = {}; // Values allowed for combo options
 } option_t;
 
 // Global array storing UCI engine options
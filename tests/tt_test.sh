@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+
+# Runs the transposition table tests: the lockless stress test, the large
+# (over 2GB) table test and the resize (entry migration) tests, and the
+# network test (incremental accumulators & kernels).
+# The test commands are only compiled into debug builds (make debug=yes),
+# run them with: make test
+
+ENGINE=${1:-./lishex}
+# File the network test round-trips a random network through
+NETWORK=$(mktemp)
+trap 'rm -f "${NETWORK}"' EXIT
+
+# Test commands (see process_uci_cmd() in src/uci.cpp)
+TESTS=(
+    "ttstress 8 50000"
+    "ttlarge 2560"
+    "ttresize 16 64"
+    "ttresize 64 16"
+    "ttresize 16 40"
+    "ttresize 16 64 compact"
+    "ttresize 64 16 compact"
+    "nnuetest ${NETWORK}"
+)
+
+FAILED=0
+for test in "${TESTS[@]}"; do
+    echo "### ${test}"
+    # The engine runs its command-line args as a single UCI command
+    output=$(${ENGINE} ${test})
+    echo "${output}"
+    if ! echo "${output}" | grep -qx "Passed"; then
+        echo "### FAILED: ${test}"
+        FAILED=$((FAILED + 1))
+    fi
+done
+
+echo "### ${#TESTS[@]} tests, ${FAILED} failed"
+[[ ${FAILED} -eq 0 ]]